@@ -24,6 +24,17 @@
 #include "platform.h"
 #include "aexcl_lib.h"
 
+#if LINUX
+#include <time.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <linux/rtnetlink.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#endif
+
 extern log_level	util_loglevel;
 static log_level	*loglevel = &util_loglevel;
 
@@ -145,6 +156,207 @@ int open_udp_socket(struct in_addr host, unsigned short *port, bool blocking)
 	return sd;
 }
 
+#if LINUX
+/*
+ * find the kind of root qdisc(s) of the interface that owns local address
+ * returns true if one of them is able to honor SO_TXTIME (fq or etf)
+ */
+static bool txtime_qdisc(struct in_addr local, bool *etf)
+{
+	struct ifaddrs *ifa, *ifap;
+	struct {
+		struct nlmsghdr nlh;
+		struct tcmsg tcm;
+	} req;
+	char buf[8192];
+	unsigned ifindex = 0;
+	bool found = false, done = false;
+	int sd, len;
+
+	if (getifaddrs(&ifap)) return false;
+
+	for (ifa = ifap; ifa; ifa = ifa->ifa_next) {
+		if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET) continue;
+		if (((struct sockaddr_in*) ifa->ifa_addr)->sin_addr.s_addr != local.s_addr) continue;
+		ifindex = if_nametoindex(ifa->ifa_name);
+		break;
+	}
+
+	freeifaddrs(ifap);
+
+	if (!ifindex || (sd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0) return false;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	req.nlh.nlmsg_type = RTM_GETQDISC;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.tcm.tcm_family = AF_UNSPEC;
+
+	if (send(sd, &req, req.nlh.nlmsg_len, 0) < 0) {
+		closesocket(sd);
+		return false;
+	}
+
+	while (!done && (len = recv(sd, buf, sizeof(buf), 0)) > 0) {
+		struct nlmsghdr *nlh;
+
+		for (nlh = (struct nlmsghdr*) buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			struct tcmsg *tcm = NLMSG_DATA(nlh);
+			struct rtattr *rta;
+			int alen;
+
+			if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) {
+				done = true;
+				break;
+			}
+
+			if (nlh->nlmsg_type != RTM_NEWQDISC || tcm->tcm_ifindex != (int) ifindex) continue;
+
+			alen = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct tcmsg));
+			for (rta = TCA_RTA(tcm); RTA_OK(rta, alen); rta = RTA_NEXT(rta, alen)) {
+				if (rta->rta_type != TCA_KIND) continue;
+				if (!strcmp(RTA_DATA(rta), "fq")) found = true;
+				if (!strcmp(RTA_DATA(rta), "etf")) found = *etf = true;
+			}
+		}
+	}
+
+	closesocket(sd);
+
+	return found;
+}
+
+/*
+ * enable launch time (SO_TXTIME) on an udp socket, only if the egress qdisc
+ * honors it, otherwise packets would just be sent immediately
+ * returns the clock to use for SCM_TXTIME or -1 if not available
+ */
+int enable_txtime(int sd, struct in_addr local)
+{
+	struct sock_txtime cfg;
+	bool etf = false;
+
+	if (!txtime_qdisc(local, &etf)) {
+		LOG_INFO("no fq/etf qdisc for %s, no SO_TXTIME", inet_ntoa(local));
+		return -1;
+	}
+
+	// fq uses monotonic clock and etf is usually configured with TAI
+	cfg.clockid = etf ? CLOCK_TAI : CLOCK_MONOTONIC;
+	cfg.flags = SOF_TXTIME_REPORT_ERRORS;
+
+	if (setsockopt(sd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg))) {
+		LOG_WARN("cannot set SO_TXTIME: %s", strerror(errno));
+		return -1;
+	}
+
+	return cfg.clockid;
+}
+
+/*
+ * stop launch time error reports (the option itself can't be removed, but
+ * packets sent w/o SCM_TXTIME are not delayed by the qdisc)
+ */
+void disable_txtime(int sd, int clock)
+{
+	struct sock_txtime cfg;
+
+	cfg.clockid = clock;
+	cfg.flags = 0;
+
+	setsockopt(sd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg));
+	txtime_errors(sd);
+}
+
+/*
+ * send an udp packet with a launch time in ns (addr is NULL if connected)
+ */
+ssize_t send_txtime(int sd, void *data, size_t size, struct sockaddr_in *addr, u64_t txtime)
+{
+	char control[CMSG_SPACE(sizeof(u64_t))];
+	struct iovec iov = { data, size };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = addr;
+	msg.msg_namelen = addr ? sizeof(struct sockaddr_in) : 0;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_TXTIME;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(u64_t));
+	memcpy(CMSG_DATA(cmsg), &txtime, sizeof(u64_t));
+
+	return sendmsg(sd, &msg, 0);
+}
+
+/*
+ * count (and consume) launch time errors reported on the socket error queue
+ */
+int txtime_errors(int sd)
+{
+	char control[256];
+	struct msghdr msg;
+	int count = 0;
+
+	memset(&msg, 0, sizeof(msg));
+
+	while (1) {
+		struct cmsghdr *cmsg;
+
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			struct sock_extended_err *err = (struct sock_extended_err*) CMSG_DATA(cmsg);
+			if (err->ee_origin == SO_EE_ORIGIN_TXTIME) count++;
+		}
+	}
+
+	return count;
+}
+#endif
+
+/*
+ * bytes still waiting in the socket's send queue, or -1 when unknown
+ */
+int socket_outq(int sd)
+{
+	int bytes = -1;
+#if LINUX
+	if (ioctl(sd, SIOCOUTQ, &bytes) < 0) bytes = -1;
+#elif OSX
+	socklen_t len = sizeof(bytes);
+	if (getsockopt(sd, SOL_SOCKET, SO_NWRITE, &bytes, &len) < 0) bytes = -1;
+#endif
+	return bytes;
+}
+
+/*
+ * set send buffer size and return the one actually granted (Linux doubles it
+ * for its own bookkeeping and caps it to wmem_max), or -1 on error
+ */
+int set_sndbuf(int sd, int size)
+{
+	int granted;
+	socklen_t len = sizeof(granted);
+
+	if (size > 0 && setsockopt(sd, SOL_SOCKET, SO_SNDBUF, (void*) &size, sizeof(size)) < 0) {
+		LOG_WARN("cannot set SO_SNDBUF to %d (%s)", size, strerror(errno));
+	}
+
+	if (getsockopt(sd, SOL_SOCKET, SO_SNDBUF, (void*) &granted, &len) < 0) return -1;
+
+	return granted;
+}
+
 /*
  * create tcp connection
  * as long as the socket is not non-blocking, this can block the process
@@ -49,6 +49,14 @@ char *_aprintf(const char *fmt, ...);
 int poll(struct pollfd *fds, unsigned long numfds, int timeout);
 #endif
 int hex2bytes(char *hex, u8_t **bytes);
+int socket_outq(int sd);
+int set_sndbuf(int sd, int size);
+#if LINUX
+int enable_txtime(int sd, struct in_addr local);
+void disable_txtime(int sd, int clock);
+ssize_t send_txtime(int sd, void *data, size_t size, struct sockaddr_in *addr, u64_t txtime);
+int txtime_errors(int sd);
+#endif
 
 
 #endif
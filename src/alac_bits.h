@@ -0,0 +1,75 @@
+/*****************************************************************************
+ * alac_bits.h: ALAC bitstream writer
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#ifndef __ALAC_BITS_H_
+#define __ALAC_BITS_H_
+
+#include <stdint.h>
+
+/*
+ Bits are accumulated MSB first in a 64 bits register and stored by 32 bits
+ words, so that a field costs one shift/or and a word store every 32 bits
+ instead of the byte-by-byte read-modify-write of the codec's BitBuffer. Used
+ by the verbatim writer and by the adaptive Golomb coder
+*/
+typedef struct {
+	uint8_t *p;
+	uint64_t acc;
+	int bits;
+} bitwriter_t;
+
+static inline void bw_init(bitwriter_t *bw, uint8_t *p)
+{
+	bw->p = p;
+	bw->acc = 0;
+	bw->bits = 0;
+}
+
+static inline void bw_put(bitwriter_t *bw, uint32_t value, int n)
+{
+	// n <= 32, value < 2^n and less than 32 bits are pending, so nothing is lost
+	bw->acc = (bw->acc << n) | value;
+	bw->bits += n;
+
+	if (bw->bits >= 32) {
+		uint32_t word = (uint32_t) (bw->acc >> (bw->bits -= 32));
+		bw->p[0] = word >> 24;
+		bw->p[1] = word >> 16;
+		bw->p[2] = word >> 8;
+		bw->p[3] = word;
+		bw->p += 4;
+	}
+}
+
+// bits written since bw_init on p
+static inline long bw_count(bitwriter_t *bw, uint8_t *p)
+{
+	return (long) (bw->p - p) * 8 + bw->bits;
+}
+
+static inline void bw_flush(bitwriter_t *bw)
+{
+	// pad with 0 up to next byte
+	for (bw->acc <<= (8 - (bw->bits & 7)) & 7, bw->bits = (bw->bits + 7) & ~7; bw->bits; ) {
+		bw->bits -= 8;
+		*bw->p++ = (uint8_t) (bw->acc >> bw->bits);
+	}
+}
+
+#endif
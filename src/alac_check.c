@@ -0,0 +1,396 @@
+/*****************************************************************************
+ * alac_check.c: ALAC writers check & benchmark
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <math.h>
+
+#include "alac_wrapper.h"
+#include "alac_enc.h"
+
+/*
+ pcm_to_alac_raw must produce exactly what the byte-oriented writer it has
+ replaced did. That one is kept here as the reference: random full and partial
+ chunks are compared, then both are timed on full chunks.
+
+ pcm_to_alac output, from the in-tree encoder and from the codec's, is decoded
+ back with alac_to_pcm and must give the exact input. Signals are chosen to
+ reach all coding paths (noise that ends verbatim, tones, near-mono, zero runs,
+ full scale) in fast and normal mode, with partial chunks. Both encoders are
+ then timed and their compression ratio reported.
+
+ The in-tree encoder's SIMD kernels must give the same bytes as its scalar
+ ones on the same signals, both are timed as well. Returns 0 when all outputs
+ are identical.
+
+	usage: alac_check [<chunks> [<chunk_len>]]
+*/
+
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+enum { SIG_NOISE, SIG_TONE, SIG_MONO, SIG_CLICKS, SIG_SQUARE, SIG_LOW, SIG_EXTREME, SIG_COUNT };
+static const char *signals[] = { "noise", "tone", "mono", "clicks", "square", "low", "extreme" };
+
+/*----------------------------------------------------------------------------*/
+static bool ref_alac_raw(uint8_t *sample, int frames, uint8_t **out, int *size, int bsize)
+{
+	uint8_t *p;
+	uint32_t *in = (uint32_t*) sample;
+	int count;
+
+	frames = min(frames, bsize);
+
+	*out = (uint8_t*) malloc(bsize * 4 + 16);
+	p = *out;
+
+	*p++ = (1 << 5);
+	*p++ = 0;
+	*p++ = (1 << 4) | (1 << 1) | ((bsize & 0x80000000) >> 31); // b31
+	*p++ = ((bsize & 0x7f800000) << 1) >> 24;	// b30--b23
+	*p++ = ((bsize & 0x007f8000) << 1) >> 16;	// b22--b15
+	*p++ = ((bsize & 0x00007f80) << 1) >> 8;	// b14--b7
+	*p =   ((bsize & 0x0000007f) << 1);       	// b6--b0
+	*p++ |= (*in &  0x00008000) >> 15;			// LB1 b7
+
+	count = frames - 1;
+
+	while (count--) {
+		*p++ = ((*in & 0x00007f80) >> 7);
+		*p++ = ((*in & 0x0000007f) << 1) | ((*in & 0x80000000) >> 31);
+		*p++ = ((*in & 0x7f800000) >> 23);
+		*p++ = ((*in & 0x007f0000) >> 15) | ((*(in + 1) & 0x00008000) >> 15);
+		in++;
+	}
+
+	*p++ = ((*in & 0x00007f80) >> 7);
+	*p++ = ((*in & 0x0000007f) << 1) | ((*in & 0x80000000) >> 31);
+	*p++ = ((*in & 0x7f800000) >> 23);
+	*p++ = ((*in & 0x007f0000) >> 15);
+
+	count = (bsize - frames) * 4;
+	while (count--)	*p++ = 0;
+
+	*(p-1) |= 1;
+	*p = (7 >> 1) << 6;
+
+	*size = p - *out + 1;
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static double bench(bool (*encode)(uint8_t*, int, uint8_t**, int*, int), uint8_t *sample, int bsize, int loops)
+{
+	clock_t start = clock();
+	double elapsed;
+	uint8_t *out;
+	int i, size;
+
+	for (i = 0; i < loops; i++) {
+		encode(sample, bsize, &out, &size, bsize);
+		free(out);
+	}
+
+	elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	// MB/s of PCM input
+	return elapsed > 0 ? (double) bsize * 4 * loops / elapsed / 1e6 : 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static int16_t clip(int v)
+{
+	return v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void generate(int16_t *s, int frames, int type, double *phase)
+{
+	int i;
+
+	for (i = 0; i < frames; i++, s += 2, *phase += 0.03) {
+		switch (type) {
+			case SIG_NOISE:
+				s[0] = rand();
+				s[1] = rand();
+				break;
+			case SIG_TONE:
+				s[0] = clip(20000 * sin(*phase));
+				s[1] = clip(15000 * sin(*phase * 1.5 + 1));
+				break;
+			case SIG_MONO:
+				s[0] = clip(12000 * sin(*phase / 3) + rand() % 64);
+				s[1] = clip(s[0] + rand() % 16 - 8);
+				break;
+			case SIG_CLICKS:
+				s[0] = rand() % 97 ? 0 : rand() % 200 - 100;
+				s[1] = rand() % 211 ? 0 : rand();
+				break;
+			case SIG_SQUARE:
+				s[0] = (i / 50) & 1 ? 32767 : -32768;
+				s[1] = -s[0] - 1;
+				break;
+			case SIG_LOW:
+				s[0] = rand() % 3 - 1;
+				s[1] = rand() % 3 - 1;
+				break;
+			default:
+				s[0] = rand() & 1 ? 32767 : -32768;
+				s[1] = rand() & 1 ? 32767 : -32768;
+				break;
+		}
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+static int round_trip(struct alac_codec_s *encoder, struct alac_codec_s *decoder,
+					  int16_t *sample, int frames, int bsize, long *bytes)
+{
+	uint8_t *out = NULL, *in = calloc(1, bsize * 4 + 64);
+	int16_t *pcm = calloc(bsize, 4);
+	unsigned decoded = 0;
+	int size = 0, errors = 0;
+
+	if (!pcm_to_alac(encoder, (uint8_t*) sample, frames, &out, &size)) errors++;
+	else if (size > bsize * 4 + 64) errors++;
+	else {
+		// decoder reads a block_size buffer
+		memcpy(in, out, size);
+		if (!alac_to_pcm(decoder, in, (uint8_t*) pcm, 2, &decoded) ||
+			decoded != (unsigned) frames || memcmp(pcm, sample, frames * 4)) errors++;
+	}
+
+	*bytes += size;
+
+	free(out);
+	free(in);
+	free(pcm);
+
+	return errors;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static double bench_alac(struct alac_codec_s *codec, int16_t *sample, int bsize, int loops, long *bytes)
+{
+	clock_t start = clock();
+	double elapsed;
+	uint8_t *out;
+	int i, size;
+
+	for (*bytes = 0, i = 0; i < loops; i++) {
+		pcm_to_alac(codec, (uint8_t*) sample, bsize, &out, &size);
+		*bytes += size;
+		free(out);
+	}
+
+	elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	return elapsed > 0 ? (double) bsize * 4 * loops / elapsed / 1e6 : 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static double bench_kernels(alac_enc_t *enc, int16_t *sample, int bsize, int loops)
+{
+	clock_t start = clock();
+	double elapsed;
+	uint8_t *out = malloc(alac_enc_max_bytes(bsize));
+	int i;
+
+	for (i = 0; i < loops; i++) alac_enc_frame(enc, (uint8_t*) sample, bsize, out);
+
+	elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+	free(out);
+
+	return elapsed > 0 ? (double) bsize * 4 * loops / elapsed / 1e6 : 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+	int chunks = argc > 1 ? atoi(argv[1]) : 20000;
+	int bsize = argc > 2 ? atoi(argv[2]) : 352;
+	int i, j, mode, errors = 0, total = 0;
+	struct alac_codec_s *encoder, *decoder;
+	uint8_t *sample, cookie[24], sample_size, channels, *simd_out, *scalar_out;
+	alac_enc_t *simd, *scalar;
+	unsigned rate;
+	double phase = 0;
+
+	if (chunks <= 0 || bsize <= 0 || (sample = malloc(bsize * 4)) == NULL) {
+		printf("usage: %s [<chunks> [<chunk_len>]]\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+
+	for (i = 0; i < chunks; i++) {
+		int frames = i % 2 ? bsize : 1 + rand() % bsize, ref_size, size;
+		uint8_t *ref, *out;
+
+		for (j = 0; j < bsize * 4; j++) sample[j] = rand();
+
+		ref_alac_raw(sample, frames, &ref, &ref_size, bsize);
+		pcm_to_alac_raw(sample, frames, &out, &size, bsize);
+
+		if (size != ref_size || memcmp(ref, out, size)) {
+			if (!errors++) printf("chunk %d (%d frames): mismatch (size %d/%d)\n", i, frames, size, ref_size);
+		}
+
+		free(ref);
+		free(out);
+	}
+
+	printf("%d chunks of %d frames max: %d mismatch\n", chunks, bsize, errors);
+
+	i = 100000000 / (bsize * 4);
+	printf("reference: %.0f MB/s\n", bench(ref_alac_raw, sample, bsize, i));
+	printf("current:   %.0f MB/s\n", bench(pcm_to_alac_raw, sample, bsize, i));
+
+	total += errors;
+
+	// what raopcl sends: frame length, 16 bits, pb 40, mb 10, kb 14, stereo, max run 255, 44100
+	memset(cookie, 0, sizeof(cookie));
+	cookie[0] = bsize >> 24; cookie[1] = bsize >> 16; cookie[2] = bsize >> 8; cookie[3] = bsize;
+	cookie[5] = 16; cookie[6] = 40; cookie[7] = 10; cookie[8] = 14; cookie[9] = 2;
+	cookie[11] = 255;
+	cookie[22] = 44100 >> 8; cookie[23] = 44100 & 0xff;
+
+	encoder = alac_create_encoder(bsize, 44100, 16, 2);
+	decoder = alac_create_decoder(sizeof(cookie), cookie, &sample_size, &rate, &channels);
+
+	if (!encoder || !decoder) {
+		printf("cannot create ALAC encoder/decoder\n");
+		return 1;
+	}
+
+	// in-tree and codec encoders, each in fast and normal mode
+	for (mode = 0; mode < 4; mode++) {
+		int type;
+		bool native = mode < 2, fast = mode & 1;
+
+		if (!alac_set_native_mode(encoder, native)) {
+			printf("%s encoder not available\n", native ? "in-tree" : "codec");
+			continue;
+		}
+
+		alac_set_fast_mode(encoder, fast);
+
+		for (type = 0; type < SIG_COUNT; type++) {
+			long bytes = 0, in = 0;
+
+			for (errors = 0, i = 0; i < chunks / SIG_COUNT / 4 + 1; i++) {
+				int frames = i % 4 ? bsize : 1 + rand() % bsize;
+
+				generate((int16_t*) sample, frames, type, &phase);
+				if (round_trip(encoder, decoder, (int16_t*) sample, frames, bsize, &bytes)) {
+					if (!errors++) printf("%s %s chunk %d (%d frames): mismatch\n", native ? "in-tree" : "codec",
+										  signals[type], i, frames);
+				}
+				in += frames * 4;
+			}
+
+			printf("%-7s %-6s %-8s ratio %.3f, %d mismatch\n", native ? "in-tree" : "codec", fast ? "fast" : "normal",
+					signals[type], (double) bytes / in, errors);
+			total += errors;
+		}
+	}
+
+	// same frames from SIMD and scalar kernels, on the same running coefficients
+	simd = alac_enc_create(bsize);
+	scalar = alac_enc_create(bsize);
+	simd_out = malloc(alac_enc_max_bytes(bsize));
+	scalar_out = malloc(alac_enc_max_bytes(bsize));
+
+	if (!simd || !scalar || !simd_out || !scalar_out) {
+		printf("cannot create in-tree encoders\n");
+		return 1;
+	}
+
+	alac_enc_set_simd(scalar, false);
+
+	if (alac_enc_set_simd(simd, true)) {
+		for (mode = 0; mode < 2; mode++) {
+			int type;
+
+			alac_enc_set_fast_mode(simd, mode);
+			alac_enc_set_fast_mode(scalar, mode);
+
+			for (errors = 0, type = 0; type < SIG_COUNT; type++) {
+				for (i = 0; i < chunks / SIG_COUNT / 2 + 1; i++) {
+					int frames = i % 4 ? bsize : 1 + rand() % bsize, size;
+
+					generate((int16_t*) sample, frames, type, &phase);
+					size = alac_enc_frame(simd, sample, frames, simd_out);
+
+					if (size != alac_enc_frame(scalar, sample, frames, scalar_out) || memcmp(simd_out, scalar_out, size)) {
+						if (!errors++) printf("simd %s chunk %d (%d frames): differs from scalar\n", signals[type], i, frames);
+					}
+				}
+			}
+
+			printf("simd    %-6s all signals, %d mismatch\n", mode ? "fast" : "normal", errors);
+			total += errors;
+		}
+	} else printf("no SIMD kernels for this CPU\n");
+
+	// throughput on music-like content
+	phase = 0;
+	generate((int16_t*) sample, bsize, SIG_MONO, &phase);
+	i = 100000000 / (bsize * 4);
+
+	for (mode = 0; mode < 2; mode++) {
+		alac_enc_set_fast_mode(simd, mode);
+		alac_enc_set_fast_mode(scalar, mode);
+		printf("kernels %-6s scalar %.0f MB/s, simd %.0f MB/s\n", mode ? "fast" : "normal",
+			   bench_kernels(scalar, (int16_t*) sample, bsize, i), bench_kernels(simd, (int16_t*) sample, bsize, i));
+	}
+
+	for (mode = 0; mode < 4; mode++) {
+		bool native = mode < 2, fast = mode & 1;
+		long bytes;
+		double speed;
+
+		if (!alac_set_native_mode(encoder, native)) continue;
+		alac_set_fast_mode(encoder, fast);
+		speed = bench_alac(encoder, (int16_t*) sample, bsize, i, &bytes);
+		printf("%-7s %-6s %.0f MB/s, ratio %.3f\n", native ? "in-tree" : "codec", fast ? "fast" : "normal",
+			   speed, (double) bytes / ((double) bsize * 4 * i));
+	}
+
+	alac_delete_encoder(encoder);
+	alac_delete_decoder(decoder);
+	alac_enc_delete(simd);
+	alac_enc_delete(scalar);
+	free(simd_out);
+	free(scalar_out);
+	free(sample);
+
+	return total ? 1 : 0;
+}
@@ -0,0 +1,570 @@
+/*****************************************************************************
+ * alac_enc.c: in-tree ALAC encoder for 16 bits stereo
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "alac_bits.h"
+#include "alac_enc.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ALAC_X86	1
+#define TARGET(isa)	__attribute__((target(isa)))
+#include <immintrin.h>
+#else
+#define ALAC_X86	0
+#endif
+
+/*
+ Each stage mirrors what the decoder does, which is all that matters for a
+ lossless codec: the decoder re-runs the same predictor with the same
+ coefficient adaptation and the same Golomb parameter history, so encoder
+ and decoder must agree bit for bit on every integer operation. Arithmetic
+ that can overflow is done modulo 2^32 like the reference decoder does.
+
+ - matrix: u = (res * l + (2^bits - res) * r) >> bits, v = l - r
+ - predictor: order 8, sign-sign adaptive FIR, residuals on 17 bits
+ - entropy: adaptive Golomb with zero runs, escape after 9 ones
+
+ The matrix and the predictor (FIR and coefficient adaptation) have SSE2,
+ SSE4.1 and AVX2 versions picked at runtime for the CPU, the scalar ones being
+ the reference. They use the same modulo 2^32 products and sums so that the
+ bitstream is identical
+*/
+
+#define ALAC_PB			40		// Golomb history multiplier (magic cookie)
+#define ALAC_MB			10		// Golomb initial history (magic cookie)
+#define ALAC_KB			14		// Golomb parameter limit (magic cookie)
+#define ALAC_PB_FACTOR	4		// per channel multiplier of ALAC_PB, in quarters
+#define ALAC_DENSHIFT	9
+#define ALAC_ORDER		8
+#define ALAC_MIX_BITS	2
+#define ALAC_MIX_RES	2		// mid/side
+#define ALAC_CHAN_BITS	17		// stereo side channel needs one more bit
+#define ALAC_MAX_PREFIX	9
+#define ALAC_MAX_FRAME	4096
+
+typedef void (*mix_fn)(uint8_t *in, int32_t *u, int32_t *v, int frames, int res);
+typedef void (*pc_fn)(int32_t *in, int32_t *pc, int num, int16_t *coefs);
+
+struct alac_enc_s {
+	int frame_size;
+	bool fast;
+	mix_fn mix16;
+	pc_fn pc_block;
+	int32_t *mix[2], *pc[2];
+	int16_t coefs[2][ALAC_ORDER];	// oldest sample first, carried from frame to frame
+	uint8_t *scratch;
+};
+
+/*----------------------------------------------------------------------------*/
+static inline int32_t signx(int32_t x)
+{
+	return (int32_t) ((uint32_t) x << (32 - ALAC_CHAN_BITS)) >> (32 - ALAC_CHAN_BITS);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static inline int32_t sign_of(int32_t x)
+{
+	return (x > 0) - (x < 0);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static inline int lg2(uint32_t x)
+{
+#if defined(__GNUC__)
+	return 31 - __builtin_clz(x);
+#else
+	int n = 0;
+	while (x >>= 1) n++;
+	return n;
+#endif
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void mix16_c(uint8_t *in, int32_t *u, int32_t *v, int frames, int res)
+{
+	int32_t m2 = (1 << ALAC_MIX_BITS) - res;
+	int16_t s[2];
+	int i;
+
+	for (i = 0; i < frames; i++, in += 4) {
+		memcpy(s, in, sizeof(s));
+		if (res) {
+			u[i] = (res * s[0] + m2 * s[1]) >> ALAC_MIX_BITS;
+			v[i] = s[0] - s[1];
+		} else {
+			u[i] = s[0];
+			v[i] = s[1];
+		}
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+static inline int _pc_start(int32_t *in, int32_t *pc, int num)
+{
+	int i;
+
+	pc[0] = in[0];
+
+	// first ones are plain differences
+	for (i = 1; i <= ALAC_ORDER && i < num; i++) pc[i] = signx(in[i] - in[i - 1]);
+
+	return i;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void pc_block_c(int32_t *in, int32_t *pc, int num, int16_t *coefs)
+{
+	int i, j;
+
+	for (i = _pc_start(in, pc, num); i < num; i++) {
+		int32_t *w = in + i - ALAC_ORDER, d = w[-1], e, p;
+		uint32_t sum = 0;
+
+		// prediction is relative to the sample just before the window
+		for (j = 0; j < ALAC_ORDER; j++) sum += (uint32_t) (w[j] - d) * (uint32_t) coefs[j];
+		p = (int32_t) (sum + (1 << (ALAC_DENSHIFT - 1))) >> ALAC_DENSHIFT;
+
+		pc[i] = e = signx((int32_t) ((uint32_t) in[i] - (uint32_t) d - (uint32_t) p));
+
+		// move coefficients against the error, oldest first, until it's used up
+		if (e) {
+			int32_t sgn = sign_of(e);
+
+			for (j = 0; j < ALAC_ORDER && e * sgn > 0; j++) {
+				int32_t val = d - w[j], s = sign_of(val) * sgn;
+				coefs[j] -= s;
+				e -= ((val * s) >> ALAC_DENSHIFT) * (j + 1);
+			}
+		}
+	}
+}
+
+
+#if ALAC_X86
+/*----------------------------------------------------------------------------*/
+TARGET("sse2") static void mix16_sse2(uint8_t *in, int32_t *u, int32_t *v, int frames, int res)
+{
+	// a frame is one 32 bits lane (l low, r high), madd gives a * l + b * r for weights (a, b)
+	__m128i wu = _mm_set1_epi32(res ? (int32_t) (((uint32_t) ((1 << ALAC_MIX_BITS) - res) << 16) | res) : 1);
+	__m128i wv = _mm_set1_epi32(res ? (int32_t) 0xffff0001 : 1 << 16);
+	__m128i shift = _mm_cvtsi32_si128(res ? ALAC_MIX_BITS : 0);
+	int i;
+
+	for (i = 0; i + 4 <= frames; i += 4, in += 16) {
+		__m128i s = _mm_loadu_si128((__m128i*) in);
+		_mm_storeu_si128((__m128i*) (u + i), _mm_sra_epi32(_mm_madd_epi16(s, wu), shift));
+		_mm_storeu_si128((__m128i*) (v + i), _mm_madd_epi16(s, wv));
+	}
+
+	mix16_c(in, u + i, v + i, frames - i, res);
+}
+
+
+/*----------------------------------------------------------------------------*/
+TARGET("avx2") static void mix16_avx2(uint8_t *in, int32_t *u, int32_t *v, int frames, int res)
+{
+	__m256i wu = _mm256_set1_epi32(res ? (int32_t) (((uint32_t) ((1 << ALAC_MIX_BITS) - res) << 16) | res) : 1);
+	__m256i wv = _mm256_set1_epi32(res ? (int32_t) 0xffff0001 : 1 << 16);
+	__m128i shift = _mm_cvtsi32_si128(res ? ALAC_MIX_BITS : 0);
+	int i;
+
+	for (i = 0; i + 8 <= frames; i += 8, in += 32) {
+		__m256i s = _mm256_loadu_si256((__m256i*) in);
+		_mm256_storeu_si256((__m256i*) (u + i), _mm256_sra_epi32(_mm256_madd_epi16(s, wu), shift));
+		_mm256_storeu_si256((__m256i*) (v + i), _mm256_madd_epi16(s, wv));
+	}
+
+	mix16_c(in, u + i, v + i, frames - i, res);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/*
+ Coefficients stay in registers as 32 bits lanes, wrapped to 16 bits after each
+ update like the scalar int16_t. The FIR uses mullo which keeps the low 32 bits
+ of products, same as the scalar modulo 2^32 arithmetic.
+
+ The scalar adaptation stops at the first j where the error has changed sign or
+ reached 0. Each step moves |e| towards 0 by t(j) = (|d - w[j]| >> shift) *
+ (j + 1), rounded up when e < 0 as the shift is arithmetic, so the steps taken
+ are exactly those where |e| > t(0) + ... + t(j - 1). Both roundings are summed
+ ahead while the prediction is computed, the error then only selects one and
+ masks the coefficient updates
+*/
+TARGET("sse4.1") static inline __m128i _prefix_sse41(__m128i t)
+{
+	// what was used before reaching each j
+	__m128i p = _mm_add_epi32(t, _mm_slli_si128(t, 4));
+	p = _mm_add_epi32(p, _mm_slli_si128(p, 8));
+	return _mm_sub_epi32(p, t);
+}
+
+
+/*----------------------------------------------------------------------------*/
+TARGET("sse4.1") static void pc_block_sse41(int32_t *in, int32_t *pc, int num, int16_t *coefs)
+{
+	__m128i c = _mm_loadu_si128((__m128i*) coefs), c0 = _mm_cvtepi16_epi32(c), c1 = _mm_cvtepi16_epi32(_mm_srli_si128(c, 8));
+	__m128i one = _mm_set1_epi32(1), round = _mm_set1_epi32((1 << ALAC_DENSHIFT) - 1);
+	__m128i j0 = _mm_setr_epi32(1, 2, 3, 4), j1 = _mm_setr_epi32(5, 6, 7, 8);
+	int i;
+
+	for (i = _pc_start(in, pc, num); i < num; i++) {
+		int32_t *w = in + i - ALAC_ORDER, d = w[-1], e, p;
+		__m128i vd = _mm_set1_epi32(d);
+		__m128i x0 = _mm_sub_epi32(_mm_loadu_si128((__m128i*) w), vd);
+		__m128i x1 = _mm_sub_epi32(_mm_loadu_si128((__m128i*) (w + 4)), vd);
+		__m128i sum = _mm_add_epi32(_mm_mullo_epi32(x0, c0), _mm_mullo_epi32(x1, c1));
+		__m128i a0 = _mm_abs_epi32(x0), a1 = _mm_abs_epi32(x1), t0, t1, pp0, pp1, pn0, pn1, ve, ae, m0, m1;
+
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		p = (int32_t) ((uint32_t) _mm_cvtsi128_si32(sum) + (1 << (ALAC_DENSHIFT - 1))) >> ALAC_DENSHIFT;
+
+		// steps for e > 0 and for e < 0, the second half starts where the first ends
+		t0 = _mm_mullo_epi32(_mm_srli_epi32(a0, ALAC_DENSHIFT), j0);
+		t1 = _mm_mullo_epi32(_mm_srli_epi32(a1, ALAC_DENSHIFT), j1);
+		pp0 = _prefix_sse41(t0);
+		pp1 = _mm_add_epi32(_prefix_sse41(t1), _mm_shuffle_epi32(_mm_add_epi32(pp0, t0), _MM_SHUFFLE(3, 3, 3, 3)));
+		t0 = _mm_mullo_epi32(_mm_srli_epi32(_mm_add_epi32(a0, round), ALAC_DENSHIFT), j0);
+		t1 = _mm_mullo_epi32(_mm_srli_epi32(_mm_add_epi32(a1, round), ALAC_DENSHIFT), j1);
+		pn0 = _prefix_sse41(t0);
+		pn1 = _mm_add_epi32(_prefix_sse41(t1), _mm_shuffle_epi32(_mm_add_epi32(pn0, t0), _MM_SHUFFLE(3, 3, 3, 3)));
+
+		pc[i] = e = signx((int32_t) ((uint32_t) in[i] - (uint32_t) d - (uint32_t) p));
+		if (!e) continue;
+
+		ve = _mm_set1_epi32(-e);
+		ae = _mm_set1_epi32(e > 0 ? e : -e);
+		m0 = _mm_cmpgt_epi32(ae, e > 0 ? pp0 : pn0);
+		m1 = _mm_cmpgt_epi32(ae, e > 0 ? pp1 : pn1);
+
+		// sign(d - w[j]) * sign(e) = sign(w[j] - d) * sign(-e) where the step is taken
+		c0 = _mm_sub_epi32(c0, _mm_and_si128(_mm_sign_epi32(_mm_sign_epi32(one, x0), ve), m0));
+		c1 = _mm_sub_epi32(c1, _mm_and_si128(_mm_sign_epi32(_mm_sign_epi32(one, x1), ve), m1));
+		c0 = _mm_srai_epi32(_mm_slli_epi32(c0, 16), 16);
+		c1 = _mm_srai_epi32(_mm_slli_epi32(c1, 16), 16);
+	}
+
+	_mm_storeu_si128((__m128i*) coefs, _mm_packs_epi32(c0, c1));
+}
+
+
+/*----------------------------------------------------------------------------*/
+TARGET("avx2") static void pc_block_avx2(int32_t *in, int32_t *pc, int num, int16_t *coefs)
+{
+	__m256i c = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*) coefs));
+	__m256i one = _mm256_set1_epi32(1), round = _mm256_set1_epi32((1 << ALAC_DENSHIFT) - 1);
+	__m256i j = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8);
+	int i;
+
+	for (i = _pc_start(in, pc, num); i < num; i++) {
+		int32_t *w = in + i - ALAC_ORDER, d = w[-1], e, p;
+		__m256i x = _mm256_sub_epi32(_mm256_loadu_si256((__m256i*) w), _mm256_set1_epi32(d));
+		__m256i prod = _mm256_mullo_epi32(x, c), a = _mm256_abs_epi32(x), t, pp, pn, m;
+		__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(prod), _mm256_extracti128_si256(prod, 1));
+
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		p = (int32_t) ((uint32_t) _mm_cvtsi128_si32(sum) + (1 << (ALAC_DENSHIFT - 1))) >> ALAC_DENSHIFT;
+
+		// prefix sums per 128 bits lane, then the low lane's total is added to the high one
+		t = _mm256_mullo_epi32(_mm256_srli_epi32(a, ALAC_DENSHIFT), j);
+		pp = _mm256_add_epi32(t, _mm256_slli_si256(t, 4));
+		pp = _mm256_add_epi32(pp, _mm256_slli_si256(pp, 8));
+		pp = _mm256_sub_epi32(_mm256_add_epi32(pp, _mm256_permute2x128_si256(_mm256_shuffle_epi32(pp, 0xff), pp, 0x08)), t);
+		t = _mm256_mullo_epi32(_mm256_srli_epi32(_mm256_add_epi32(a, round), ALAC_DENSHIFT), j);
+		pn = _mm256_add_epi32(t, _mm256_slli_si256(t, 4));
+		pn = _mm256_add_epi32(pn, _mm256_slli_si256(pn, 8));
+		pn = _mm256_sub_epi32(_mm256_add_epi32(pn, _mm256_permute2x128_si256(_mm256_shuffle_epi32(pn, 0xff), pn, 0x08)), t);
+
+		pc[i] = e = signx((int32_t) ((uint32_t) in[i] - (uint32_t) d - (uint32_t) p));
+		if (!e) continue;
+
+		m = _mm256_cmpgt_epi32(_mm256_set1_epi32(e > 0 ? e : -e), e > 0 ? pp : pn);
+		c = _mm256_sub_epi32(c, _mm256_and_si256(_mm256_sign_epi32(_mm256_sign_epi32(one, x), _mm256_set1_epi32(-e)), m));
+		c = _mm256_srai_epi32(_mm256_slli_epi32(c, 16), 16);
+	}
+
+	_mm_storeu_si128((__m128i*) coefs, _mm_packs_epi32(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1)));
+}
+#endif
+
+
+/*----------------------------------------------------------------------------*/
+static inline void ag_put(bitwriter_t *bw, uint32_t x, int k, int bits)
+{
+	uint32_t m = (1 << k) - 1, q = x / m, r = x - q * m;
+
+	if (q < ALAC_MAX_PREFIX) {
+		// q ones and a zero, then the remainder on k bits (+1) or k-1 bits when 0
+		bw_put(bw, ((1 << q) - 1) << 1, q + 1);
+		if (k == 1) return;
+		if (r) bw_put(bw, r + 1, k);
+		else bw_put(bw, 0, k - 1);
+	} else {
+		// escape: 9 ones then the value itself
+		bw_put(bw, (1 << ALAC_MAX_PREFIX) - 1, ALAC_MAX_PREFIX);
+		bw_put(bw, x, bits);
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool ag_encode(bitwriter_t *bw, int32_t *pc, int num)
+{
+	uint32_t history = ALAC_MB, mult = ALAC_PB * ALAC_PB_FACTOR / 4;
+	int i, k, modifier = 0;
+
+	for (i = 0; i < num; i++) {
+		// residuals are folded to positive, odd ones being negative
+		uint32_t x = ((uint32_t) pc[i] << 1) ^ (uint32_t) (pc[i] >> 31);
+
+		/*
+		 Decoders do not agree on the history clamp when a value right after
+		 a run is exactly 65536 (with or without the run's -1), let the caller
+		 send that frame verbatim instead
+		*/
+		if (modifier && x == 0x10000) return false;
+
+		k = lg2((history >> 9) + 3);
+		ag_put(bw, x - modifier, k > ALAC_KB ? ALAC_KB : k, ALAC_CHAN_BITS);
+		modifier = 0;
+
+		if (x > 0xffff) history = 0xffff;
+		else history += x * mult - ((history * mult) >> 9);
+
+		// when history is low, a run of zeros follows (possibly empty)
+		if (history < 128 && i + 1 < num) {
+			int run;
+
+			for (run = 0; i + 1 + run < num && !pc[i + 1 + run]; run++);
+
+			k = 7 - lg2(history) + ((history + 16) >> 6);
+			ag_put(bw, run, k > ALAC_KB ? ALAC_KB : k, 16);
+
+			// value after a run can't be 0, so it is sent minus 1
+			i += run;
+			modifier = 1;
+			history = 0;
+		}
+	}
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _enc_element(alac_enc_t *enc, uint8_t *in, int frames, int res,
+						 int16_t coefs[2][ALAC_ORDER], bitwriter_t *bw)
+{
+	int c, j;
+
+	enc->mix16(in, enc->mix[0], enc->mix[1], frames, res);
+
+	// stereo element (3) + instance (4) + unused (12)
+	bw_put(bw, 1 << 16, 19);
+	// partial (1) + shift (2) + escape/verbatim (1) then number of samples if partial
+	bw_put(bw, (frames != enc->frame_size) << 3, 4);
+	if (frames != enc->frame_size) bw_put(bw, frames, 32);
+
+	bw_put(bw, (ALAC_MIX_BITS << 8) | res, 16);
+
+	for (c = 0; c < 2; c++) {
+		// mode (4) + shift (4) + pb factor (3) + order (5), coefficients of most recent first
+		bw_put(bw, (ALAC_DENSHIFT << 8) | (ALAC_PB_FACTOR << 5) | ALAC_ORDER, 16);
+		for (j = ALAC_ORDER - 1; j >= 0; j--) bw_put(bw, (uint16_t) coefs[c][j], 16);
+	}
+
+	for (c = 0; c < 2; c++) {
+		enc->pc_block(enc->mix[c], enc->pc[c], frames, coefs[c]);
+		if (!ag_encode(bw, enc->pc[c], frames)) return false;
+	}
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _enc_verbatim(alac_enc_t *enc, uint8_t *in, int frames, bitwriter_t *bw)
+{
+	int16_t s[2];
+	int i;
+
+	bw_put(bw, 1 << 16, 19);
+	bw_put(bw, ((frames != enc->frame_size) << 3) | 1, 4);
+	if (frames != enc->frame_size) bw_put(bw, frames, 32);
+
+	// each frame is L then R, both 16 bits big endian
+	for (i = 0; i < frames; i++, in += 4) {
+		memcpy(s, in, sizeof(s));
+		bw_put(bw, ((uint32_t) (uint16_t) s[0] << 16) | (uint16_t) s[1], 32);
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+int alac_enc_frame(alac_enc_t *enc, uint8_t *in, int frames, uint8_t *out)
+{
+	int16_t coefs[2][ALAC_ORDER];
+	long bits, verbatim;
+	bitwriter_t bw;
+
+	if (frames > enc->frame_size) frames = enc->frame_size;
+
+	verbatim = 19 + 4 + (frames != enc->frame_size ? 32 : 0) + frames * 32L;
+
+	// mid/side is what usually wins
+	memcpy(coefs, enc->coefs, sizeof(coefs));
+	bw_init(&bw, out);
+	bits = _enc_element(enc, in, frames, ALAC_MIX_RES, coefs, &bw) ? bw_count(&bw, out) : verbatim;
+
+	// left/right from the same starting coefficients, keep the smaller
+	if (!enc->fast) {
+		int16_t alt[2][ALAC_ORDER];
+		bitwriter_t lr;
+
+		memcpy(alt, enc->coefs, sizeof(alt));
+		bw_init(&lr, enc->scratch);
+
+		if (_enc_element(enc, in, frames, 0, alt, &lr) && bw_count(&lr, enc->scratch) < bits) {
+			memcpy(out, enc->scratch, lr.p - enc->scratch);
+			bw = lr;
+			bw.p = out + (lr.p - enc->scratch);
+			bits = bw_count(&bw, out);
+			memcpy(coefs, alt, sizeof(alt));
+		}
+	}
+
+	// coefficients move on only if the decoder sees them
+	if (bits < verbatim) {
+		memcpy(enc->coefs, coefs, sizeof(coefs));
+	} else {
+		bw_init(&bw, out);
+		_enc_verbatim(enc, in, frames, &bw);
+	}
+
+	// end tag
+	bw_put(&bw, 7, 3);
+	bw_flush(&bw);
+
+	return bw.p - out;
+}
+
+
+/*----------------------------------------------------------------------------*/
+int alac_enc_max_bytes(int frames)
+{
+	/*
+	 A compressed attempt is written in full before being compared with
+	 verbatim: per sample and channel at most an escaped value (26 bits) and
+	 a zero run (25 bits), plus headers
+	*/
+	return frames * 13 + 64;
+}
+
+
+/*----------------------------------------------------------------------------*/
+alac_enc_t *alac_enc_create(int frame_size)
+{
+	alac_enc_t *enc;
+	int c;
+
+	if (frame_size <= 0 || frame_size > ALAC_MAX_FRAME || (enc = calloc(1, sizeof(alac_enc_t))) == NULL) return NULL;
+
+	enc->frame_size = frame_size;
+	enc->fast = true;
+	alac_enc_set_simd(enc, true);
+
+	for (c = 0; c < 2; c++) {
+		enc->mix[c] = malloc(frame_size * sizeof(int32_t));
+		enc->pc[c] = malloc(frame_size * sizeof(int32_t));
+
+		// same start as the reference encoder: 38, -29, -2 (<< 9 >> 4) for the most recent ones
+		enc->coefs[c][ALAC_ORDER - 1] = 1216;
+		enc->coefs[c][ALAC_ORDER - 2] = -928;
+		enc->coefs[c][ALAC_ORDER - 3] = -64;
+	}
+
+	enc->scratch = malloc(alac_enc_max_bytes(frame_size));
+
+	if (!enc->mix[0] || !enc->mix[1] || !enc->pc[0] || !enc->pc[1] || !enc->scratch) {
+		alac_enc_delete(enc);
+		return NULL;
+	}
+
+	return enc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void alac_enc_delete(alac_enc_t *enc)
+{
+	int c;
+
+	if (!enc) return;
+
+	for (c = 0; c < 2; c++) {
+		free(enc->mix[c]);
+		free(enc->pc[c]);
+	}
+
+	free(enc->scratch);
+	free(enc);
+}
+
+
+/*----------------------------------------------------------------------------*/
+void alac_enc_set_fast_mode(alac_enc_t *enc, bool fast)
+{
+	if (enc) enc->fast = fast;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool alac_enc_set_simd(alac_enc_t *enc, bool simd)
+{
+	enc->mix16 = mix16_c;
+	enc->pc_block = pc_block_c;
+
+#if ALAC_X86
+	if (!simd) return false;
+
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		enc->mix16 = mix16_avx2;
+		enc->pc_block = pc_block_avx2;
+	} else {
+		if (__builtin_cpu_supports("sse2")) enc->mix16 = mix16_sse2;
+		if (__builtin_cpu_supports("sse4.1")) enc->pc_block = pc_block_sse41;
+	}
+
+	return enc->mix16 != mix16_c || enc->pc_block != pc_block_c;
+#else
+	(void) simd;
+	return false;
+#endif
+}
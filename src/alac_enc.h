@@ -0,0 +1,56 @@
+/*****************************************************************************
+ * alac_enc.h: in-tree ALAC encoder for 16 bits stereo, header file
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#ifndef __ALAC_ENC_H_
+#define __ALAC_ENC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ Encoder for what AirPlay sessions send (16 bits, stereo, interleaved host
+ order), producing frames any ALAC decoder reads with the usual magic cookie
+ (pb 40, mb 10, kb 14). It replaces the codec's matrix, predictor, adaptive
+ Golomb and BitBuffer stages for that format only, other formats still go
+ through the codec. A frame that would not be smaller than verbatim is sent
+ verbatim
+*/
+
+typedef struct alac_enc_s alac_enc_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+alac_enc_t *alac_enc_create(int frame_size);
+void	alac_enc_delete(alac_enc_t *enc);
+// fast uses mid/side only, otherwise left/right is also tried and the smaller is kept
+void	alac_enc_set_fast_mode(alac_enc_t *enc, bool fast);
+// largest frame alac_enc_frame can write for that many frames
+int		alac_enc_max_bytes(int frames);
+// returns number of bytes written in out, frames must be <= frame_size
+int		alac_enc_frame(alac_enc_t *enc, uint8_t *in, int frames, uint8_t *out);
+// SIMD kernels are used by default when the CPU has them, returns true if they are in use
+bool	alac_enc_set_simd(alac_enc_t *enc, bool simd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
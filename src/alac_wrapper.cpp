@@ -26,6 +26,8 @@
 #include "ALACDecoder.h"
 #include "ALACBitUtilities.h"
 
+#include "alac_bits.h"
+#include "alac_enc.h"
 #include "alac_wrapper.h"
 
 #define min(a,b) (((a) < (b)) ? (a) : (b))
@@ -35,6 +37,8 @@ typedef struct alac_codec_s {
 	AudioFormatDescription inputFormat, outputFormat;
 	ALACEncoder *encoder;
 	ALACDecoder *Decoder;
+	alac_enc_t *native;
+	bool use_native;
 	unsigned block_size, frames_per_packet;
 } alac_codec_t;
 
@@ -45,6 +49,7 @@ extern "C" struct alac_codec_s *alac_create_decoder(int magic_cookie_size, unsig
 	struct alac_codec_s *codec = (struct alac_codec_s*) malloc(sizeof(struct alac_codec_s));
 
 	codec->Decoder = new ALACDecoder;
+	codec->native = NULL;
 	codec->Decoder->Init(magic_cookie, magic_cookie_size);
 
 	*channels = codec->Decoder->mConfig.numChannels;
@@ -63,6 +68,11 @@ extern "C" void alac_delete_decoder(struct alac_codec_s *codec) {
 	free(codec);
 }
 
+/*----------------------------------------------------------------------------*/
+extern "C" unsigned alac_frame_length(struct alac_codec_s *codec) {
+	return codec->frames_per_packet;
+}
+
 
 /*----------------------------------------------------------------------------*/
 
@@ -84,58 +94,34 @@ extern "C" bool alac_to_pcm(struct alac_codec_s *codec, unsigned char* input,
 // assumes stereo and little endian
 extern "C" bool pcm_to_alac_raw(uint8_t *sample, int frames, uint8_t **out, int *size, int bsize)
 {
-	uint8_t *p;
+	bitwriter_t bw;
 	uint32_t *in = (uint32_t*) sample;
 	int count;
 
 	frames = min(frames, bsize);
 
 	*out = (uint8_t*) malloc(bsize * 4 + 16);
-	p = *out;
-
-	*p++ = (1 << 5);
-	*p++ = 0;
-	*p++ = (1 << 4) | (1 << 1) | ((bsize & 0x80000000) >> 31); // b31
-	*p++ = ((bsize & 0x7f800000) << 1) >> 24;	// b30--b23
-	*p++ = ((bsize & 0x007f8000) << 1) >> 16;	// b22--b15
-	*p++ = ((bsize & 0x00007f80) << 1) >> 8;	// b14--b7
-	*p =   ((bsize & 0x0000007f) << 1);       	// b6--b0
-	*p++ |= (*in &  0x00008000) >> 15;			// LB1 b7
-
-	count = frames - 1;
-
-	while (count--) {
-		// LB1 b6--b0 + LB0 b7
-		*p++ = ((*in & 0x00007f80) >> 7);
-		// LB0 b6--b0 + RB1 b7
-		*p++ = ((*in & 0x0000007f) << 1) | ((*in & 0x80000000) >> 31);
-		// RB1 b6--b0 + RB0 b7
-		*p++ = ((*in & 0x7f800000) >> 23);
-		// RB0 b6--b0 + next LB1 b7
-		*p++ = ((*in & 0x007f0000) >> 15) | ((*(in + 1) & 0x00008000) >> 15);
-
-		in++;
-	}
+	bw_init(&bw, *out);
+
+	// stereo element (3) + instance (4) + unused (12)
+	bw_put(&bw, 1 << 16, 19);
+	// partial (1) + shift (2) + escape/verbatim (1) then number of samples
+	bw_put(&bw, (1 << 3) | 1, 4);
+	bw_put(&bw, bsize, 32);
 
-	// last sample
-	// LB1 b6--b0 + LB0 b7
-	*p++ = ((*in & 0x00007f80) >> 7);
-	// LB0 b6--b0 + RB1 b7
-	*p++ = ((*in & 0x0000007f) << 1) | ((*in & 0x80000000) >> 31);
-	// RB1 b6--b0 + RB0 b7
-	*p++ = ((*in & 0x7f800000) >> 23);
-	// RB0 b6--b0 + next LB1 b7
-	*p++ = ((*in & 0x007f0000) >> 15);
+	// each frame is L then R, both 16 bits big endian
+	for (count = frames; count--; in++) {
+		bw_put(&bw, (*in << 16) | (*in >> 16), 32);
+	}
 
 	// when readable size is less than bsize, fill 0 at the bottom
-	count = (bsize - frames) * 4;
-	while (count--)	*p++ = 0;
+	for (count = bsize - frames; count--; ) bw_put(&bw, 0, 32);
 
-	// frame footer ??
-	*(p-1) |= 1;
-	*p = (7 >> 1) << 6;
+	// end tag
+	bw_put(&bw, 7, 3);
+	bw_flush(&bw);
 
-	*size = p - *out + 1;
+	*size = bw.p - *out;
 
 	return true;
 }
@@ -145,7 +131,16 @@ extern "C" bool pcm_to_alac_raw(uint8_t *sample, int frames, uint8_t **out, int
 // assumes stereo and little endian
 extern "C" bool pcm_to_alac(struct alac_codec_s *codec, uint8_t *in, int frames, uint8_t **out, int *size)
 {
-	*size = min(frames, (int) codec->outputFormat.mFramesPerPacket) * codec->inputFormat.mBytesPerFrame;
+	frames = min(frames, (int) codec->outputFormat.mFramesPerPacket);
+
+	// 16 bits stereo does not go through the codec's matrix/predictor/Golomb
+	if (codec->use_native) {
+		if ((*out = (uint8_t*) malloc(alac_enc_max_bytes(frames))) == NULL) return false;
+		*size = alac_enc_frame(codec->native, in, frames, *out);
+		return true;
+	}
+
+	*size = frames * codec->inputFormat.mBytesPerFrame;
 	// seems that ALAC has a bug and creates more data than expected
 	*out = (uint8_t*) malloc(*size * 2 + kALACMaxEscapeHeaderBytes + 64);
 	codec->encoder->Encode(codec->inputFormat, codec->outputFormat, in, *out, size);
@@ -193,6 +188,10 @@ extern "C" struct alac_codec_s *alac_create_encoder(int chunk_len, int sampleRat
 	codec->encoder->SetFastMode(true);
 	codec->encoder->InitializeEncoder(codec->outputFormat);
 
+	// codec stays as the fallback for other formats
+	codec->native = (sampleSize == 16 && channels == 2) ? alac_enc_create(chunk_len) : NULL;
+	codec->use_native = codec->native != NULL;
+
 	return codec;
 }
 
@@ -200,9 +199,28 @@ extern "C" struct alac_codec_s *alac_create_encoder(int chunk_len, int sampleRat
 /*----------------------------------------------------------------------------*/
 extern "C" void alac_delete_encoder(struct alac_codec_s *codec)
 {
+	alac_enc_delete(codec->native);
 	delete codec->encoder;
 	free(codec);
 }
 
 
+/*----------------------------------------------------------------------------*/
+extern "C" void alac_set_fast_mode(struct alac_codec_s *codec, bool fast)
+{
+	// only selects the stereo encoding routine, can be changed between packets
+	codec->encoder->SetFastMode(fast);
+	alac_enc_set_fast_mode(codec->native, fast);
+}
+
+
+/*----------------------------------------------------------------------------*/
+extern "C" bool alac_set_native_mode(struct alac_codec_s *codec, bool native)
+{
+	// the in-tree encoder only exists for 16 bits stereo
+	codec->use_native = native && codec->native;
+	return codec->use_native == native;
+}
+
+
 
@@ -30,6 +30,7 @@ struct alac_codec_s *alac_create_decoder(int magic_cookie_size, uint8_t *magic_c
 								uint8_t *sample_size, unsigned *sample_rate,
 								uint8_t *channels);
 void alac_delete_decoder(struct alac_codec_s *codec);
+unsigned alac_frame_length(struct alac_codec_s *codec);
 bool alac_to_pcm(struct alac_codec_s *codec, uint8_t* input,
 				 uint8_t *output, char channels, unsigned *out_frames);
 
@@ -37,6 +38,8 @@ bool pcm_to_alac(struct alac_codec_s *codec, uint8_t *in, int frames, uint8_t **
 bool pcm_to_alac_raw(uint8_t *in, int frames, uint8_t **out, int *size, int bsize);
 struct alac_codec_s *alac_create_encoder(int chunk_len, int sampleRate, int sampleSize, int channels);
 void alac_delete_encoder(struct alac_codec_s *codec);
+void alac_set_fast_mode(struct alac_codec_s *codec, bool fast);
+bool alac_set_native_mode(struct alac_codec_s *codec, bool native);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,257 @@
+/*****************************************************************************
+ * raop_cache.c: receiver capability cache
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#if WIN
+#include <process.h>
+#define getpid _getpid
+#endif
+#include "log_util.h"
+#include "aexcl_lib.h"
+#include "raop_cache.h"
+
+#define MAX_CACHE_ENTRIES	256
+
+/*
+ The cache is a small text file, one receiver per line:
+	<id>\t<latency> <at> <time_late> <at> <auth_ok> <at> <verify_ok> <hash> <at>
+ The id ends with a tab as it's often a name with spaces ("Living Room"), so
+ ids with a tab or a new line can't be cached. It is entirely re-read on lookup and re-written on update, which is fine as
+ it's only touched once per connection. Writing is done in a per-process
+ temporary file then renamed so that concurrent processes never read a
+ partial file. The id is the device's identity (mDNS name, pk ...), not its
+ address which can be given to another device
+*/
+
+extern log_level	raop_loglevel;
+static log_level 	*loglevel = &raop_loglevel;
+
+static pthread_mutex_t	cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char				*cache_path;
+
+/*----------------------------------------------------------------------------*/
+static int cache_load(raop_cache_t *entries, int max)
+{
+	FILE *in;
+	char line[256];
+	int n = 0;
+
+	if ((in = fopen(cache_path, "r")) == NULL) return 0;
+
+	while (n < max && fgets(line, sizeof(line), in)) {
+		raop_cache_t *e = entries + n;
+		long long at[4];
+		int late, auth, verify;
+
+		memset(e, 0, sizeof(raop_cache_t));
+
+		if (sscanf(line, "%63[^\t]\t%u %lld %d %lld %d %lld %d %u %lld", e->id,
+				   &e->latency, &at[0], &late, &at[1], &auth, &at[2],
+				   &verify, &e->verify_hash, &at[3]) != 10) {
+			LOG_WARN("cache: ignoring malformed line %s", line);
+			continue;
+		}
+
+		e->latency_at = at[0];
+		e->time_late = late;
+		e->time_at = at[1];
+		e->auth_ok = auth;
+		e->auth_at = at[2];
+		e->verify_ok = verify;
+		e->verify_at = at[3];
+		n++;
+	}
+
+	fclose(in);
+
+	return n;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool cache_save(raop_cache_t *entries, int n)
+{
+	FILE *out;
+	char *tmp;
+	int i;
+
+	// each process has its own temporary file, only rename is shared
+	if ((tmp = _aprintf("%s.%d.tmp", cache_path, (int) getpid())) == NULL) return false;
+
+	if ((out = fopen(tmp, "w")) == NULL) {
+		LOG_ERROR("cache: cannot write %s", tmp);
+		free(tmp);
+		return false;
+	}
+
+	for (i = 0; i < n; i++) {
+		raop_cache_t *e = entries + i;
+
+		fprintf(out, "%s\t%u %lld %d %lld %d %lld %d %u %lld\n", e->id,
+				e->latency, (long long) e->latency_at, e->time_late,
+				(long long) e->time_at, e->auth_ok, (long long) e->auth_at,
+				e->verify_ok, e->verify_hash, (long long) e->verify_at);
+	}
+
+	fclose(out);
+
+#if WIN
+	remove(cache_path);
+#endif
+	if (rename(tmp, cache_path)) {
+		LOG_ERROR("cache: cannot rename %s", tmp);
+		remove(tmp);
+		free(tmp);
+		return false;
+	}
+
+	free(tmp);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_cache_open(char *path)
+{
+	pthread_mutex_lock(&cache_mutex);
+
+	if (cache_path) free(cache_path);
+	cache_path = path ? strdup(path) : NULL;
+
+	pthread_mutex_unlock(&cache_mutex);
+
+	LOG_INFO("cache: using %s", path ? path : "<none>");
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raop_cache_close(void)
+{
+	raop_cache_open(NULL);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_cache_fresh(time_t at, u32_t ttl)
+{
+	time_t now = time(NULL);
+
+	return at && at <= now && now - at < ttl;
+}
+
+
+/*----------------------------------------------------------------------------*/
+u32_t raop_cache_hash(char *str)
+{
+	// FNV-1a, only used to check that a secret has not changed
+	u32_t hash = 2166136261U;
+
+	while (str && *str) {
+		hash ^= (u8_t) *str++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_cache_lookup(char *id, raop_cache_t *entry)
+{
+	raop_cache_t *entries;
+	bool found = false;
+	int i, n;
+
+	pthread_mutex_lock(&cache_mutex);
+
+	if (!cache_path || (entries = malloc(MAX_CACHE_ENTRIES * sizeof(raop_cache_t))) == NULL) {
+		pthread_mutex_unlock(&cache_mutex);
+		return false;
+	}
+
+	n = cache_load(entries, MAX_CACHE_ENTRIES);
+
+	for (i = 0; i < n; i++) {
+		if (strcmp(entries[i].id, id)) continue;
+		*entry = entries[i];
+		found = true;
+		break;
+	}
+
+	pthread_mutex_unlock(&cache_mutex);
+
+	free(entries);
+
+	return found;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_cache_update(raop_cache_t *entry)
+{
+	raop_cache_t *entries;
+	bool rc;
+	int i, n;
+
+	// that entry could not be read back
+	if (!*entry->id || strpbrk(entry->id, "\t\r\n")) {
+		LOG_WARN("cache: cannot store id \"%s\"", entry->id);
+		return false;
+	}
+
+	pthread_mutex_lock(&cache_mutex);
+
+	if (!cache_path || (entries = malloc(MAX_CACHE_ENTRIES * sizeof(raop_cache_t))) == NULL) {
+		pthread_mutex_unlock(&cache_mutex);
+		return false;
+	}
+
+	n = cache_load(entries, MAX_CACHE_ENTRIES);
+
+	for (i = 0; i < n && strcmp(entries[i].id, entry->id); i++);
+
+	// full cache, recycle the oldest learnt entry
+	if (i == MAX_CACHE_ENTRIES) {
+		int j;
+		for (i = 0, j = 1; j < n; j++) {
+			if (entries[j].latency_at < entries[i].latency_at) i = j;
+		}
+	}
+
+	entries[i] = *entry;
+	if (i == n) n++;
+
+	rc = cache_save(entries, n);
+
+	pthread_mutex_unlock(&cache_mutex);
+
+	free(entries);
+
+	LOG_DEBUG("cache: updated %s (latency:%u late:%d auth:%d verify:%d)", entry->id,
+			  entry->latency, entry->time_late, entry->auth_ok, entry->verify_ok);
+
+	return rc;
+}
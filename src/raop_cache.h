@@ -0,0 +1,59 @@
+/*****************************************************************************
+ * raop_cache.h: receiver capability cache
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+
+#ifndef __RAOP_CACHE_H_
+#define __RAOP_CACHE_H_
+
+#include <time.h>
+#include "platform.h"
+
+/*
+ What a receiver told us during its last connections. Each fact has its own
+ learning time and is only trusted within its TTL, so that a firmware update
+ or a device replaced at the same address is re-discovered eventually
+*/
+#define CACHE_TTL_LATENCY	(7*24*3600)
+#define CACHE_TTL_TIMING	(7*24*3600)
+#define CACHE_TTL_AUTH		(24*3600)
+#define CACHE_TTL_VERIFY	(3600)
+
+#define CACHE_ID_SIZE		64
+
+typedef struct raop_cache_s {
+	char id[CACHE_ID_SIZE];
+	u32_t latency;
+	time_t latency_at;
+	bool time_late;
+	time_t time_at;
+	bool auth_ok;
+	time_t auth_at;
+	bool verify_ok;
+	u32_t verify_hash;
+	time_t verify_at;
+} raop_cache_t;
+
+bool	raop_cache_open(char *path);
+void	raop_cache_close(void);
+bool 	raop_cache_lookup(char *id, raop_cache_t *entry);
+bool 	raop_cache_update(raop_cache_t *entry);
+bool	raop_cache_fresh(time_t at, u32_t ttl);
+u32_t	raop_cache_hash(char *str);
+
+#endif
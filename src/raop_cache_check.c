@@ -0,0 +1,127 @@
+/*****************************************************************************
+ * raop_cache_check.c: capability cache file check
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "log_util.h"
+#include "raop_cache.h"
+
+/*
+ Entries written to a scratch cache file must be read back unchanged, ids
+ are device names so they have spaces. An id that could not be read back
+ (tab, new line) must be refused. Returns 0 when all is as expected.
+
+	usage: raop_cache_check [<scratch file>]
+*/
+
+log_level	raop_loglevel = lWARN;
+log_level	util_loglevel = lWARN;
+
+static int errors;
+
+/*----------------------------------------------------------------------------*/
+static void expect(bool ok, char *what, char *id)
+{
+	if (ok) return;
+	printf("\"%s\": %s\n", id, what);
+	errors++;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void fill(raop_cache_t *e, char *id, u32_t latency)
+{
+	memset(e, 0, sizeof(raop_cache_t));
+	strcpy(e->id, id);
+	e->latency = latency;
+	e->latency_at = time(NULL);
+	e->time_late = true;
+	e->time_at = e->latency_at - 1;
+	e->auth_ok = false;
+	e->auth_at = e->latency_at - 2;
+	e->verify_ok = true;
+	e->verify_hash = raop_cache_hash(id);
+	e->verify_at = e->latency_at - 3;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void check(char *id, u32_t latency)
+{
+	raop_cache_t ref, e;
+
+	fill(&ref, id, latency);
+
+	if (!raop_cache_lookup(id, &e)) {
+		expect(false, "not found", id);
+		return;
+	}
+
+	expect(!strcmp(e.id, ref.id), "id differs", id);
+	expect(e.latency == ref.latency && e.latency_at == ref.latency_at, "latency differs", id);
+	expect(e.time_late == ref.time_late && e.time_at == ref.time_at, "timing differs", id);
+	expect(e.auth_ok == ref.auth_ok && e.auth_at == ref.auth_at, "auth differs", id);
+	expect(e.verify_ok == ref.verify_ok && e.verify_hash == ref.verify_hash &&
+		   e.verify_at == ref.verify_at, "verify differs", id);
+}
+
+
+/*----------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+	char *path = argc > 1 ? argv[1] : "raop_cache_check.tmp";
+	char *ids[] = { "Living Room", "Kitchen", " Bedroom (2nd floor) ", "a" };
+	raop_cache_t e;
+	int i, n = sizeof(ids) / sizeof(ids[0]);
+
+	remove(path);
+	raop_cache_open(path);
+
+	for (i = 0; i < n; i++) {
+		fill(&e, ids[i], 11025 * (i + 1));
+		expect(raop_cache_update(&e), "cannot update", ids[i]);
+	}
+
+	for (i = 0; i < n; i++) check(ids[i], 11025 * (i + 1));
+
+	// first word of an id with spaces must not match it
+	expect(!raop_cache_lookup("Living", &e), "found by its first word", "Living");
+
+	// re-learning an entry keeps the others
+	fill(&e, ids[0], 88200);
+	expect(raop_cache_update(&e), "cannot update", ids[0]);
+	check(ids[0], 88200);
+	for (i = 1; i < n; i++) check(ids[i], 11025 * (i + 1));
+
+	// these could not be read back
+	fill(&e, "Tab\tbed", 11025);
+	expect(!raop_cache_update(&e), "accepted with a tab", e.id);
+	fill(&e, "New\nline", 11025);
+	expect(!raop_cache_update(&e), "accepted with a new line", e.id);
+
+	raop_cache_close();
+	remove(path);
+
+	printf("%d ids: %d errors\n", n, errors);
+
+	return errors ? 1 : 0;
+}
@@ -38,6 +38,10 @@
 #include "raop_client.h"
 #include "base64.h"
 #include "aes.h"
+#include "raop_cache.h"
+#include "raop_tx.h"
+#include "raop_shaper.h"
+#include "raop_pool.h"
 
 #define MAX_BACKLOG 512
 
@@ -56,6 +60,18 @@
 
 #define PUBKEY_SIZE	64
 
+#define LATENCY_MAX_MS		2000
+#define LATENCY_MARGIN_MS	100
+
+#define TXTIME_MIN_NS		200000
+#define TXTIME_CHECK		64
+
+#define OUTQ_CHECK			8
+#define OUTQ_TUNE			64		// samples between sizing decisions
+#define OUTQ_MIN_PERIODS	8
+#define OUTQ_MAX_PERIODS	(MAX_BACKLOG / 2)
+#define SNDBUF_OVERHEAD		640
+
 #define SEC(ntp) ((u32_t) ((ntp) >> 32))
 #define FRAC(ntp) ((u32_t) (ntp))
 #define SECNTP(ntp) SEC(ntp),FRAC(ntp)
@@ -154,6 +170,14 @@ typedef struct raopcl_s {
 		struct { unsigned int avail, select, send; } audio;
 	} sane;
 	unsigned int retransmit;
+	struct {
+		raop_tuning_t mode;
+		u32_t sent, lost, late;
+		u32_t nack_delay, jitter, rtt;
+		u32_t floor, recommended;
+		u32_t last_request, last_interval;
+		u64_t last_reply;
+	} tuning;
 	u8_t iv[16]; // initialization vector for aes-cbc
 	u8_t key[16]; // key for aes-cbc
 	struct in_addr	host_addr, local_addr;
@@ -172,22 +196,82 @@ typedef struct raopcl_s {
 	bool encrypt;
 	bool first_pkt;
 	u64_t head_ts, pause_ts, start_ts, first_ts;
-	bool flushing;
+	u16_t pause_seq;
+	bool flushing, repairing;
+	struct {
+		pthread_t thread;
+		bool running, joinable;
+		u16_t seq, count;
+	} resend;
+	struct {
+		u32_t horizon, lead;
+		int clock;
+		u16_t count;
+	} txtime;
+	struct raoptx_s *tx;
+	struct {
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		bool running, pooled, busy;
+		int depth, head, count, ready;
+		u32_t generation, underruns;
+		struct {
+			u8_t *pcm, *buffer;
+			int frames, size;
+		} *slots;
+	} pipeline;
+	struct {
+		bool enabled, burst;
+		u32_t margin, lead;
+	} prefill;
+	struct {
+		u32_t periods;
+		int sndbuf, queued, peak;
+		u16_t count;
+		struct {
+			bool enabled, full;
+			int peak;
+			u16_t samples;
+		} tune;
+	} outq;
 	u16_t   seq_number;
 	unsigned long ssrc;
 	u32_t latency_frames;
 	int chunk_len;
 	pthread_t time_thread, ctrl_thread;
 	pthread_mutex_t mutex;
+	pthread_mutex_t encoder;	// codec, input format & silence cache (after mutex)
 	bool time_running, ctrl_running;
 	int sample_rate, sample_size, channels;
 	raop_codec_t codec;
+	raop_input_t input;
+	bool planar;
+	u32_t dither;
+	u8_t *staging;
+	struct {
+		u8_t *buffer;
+		int size;
+	} direct;
+	struct {
+		u8_t *payload;
+		int frames, size;
+		u32_t count;
+	} silence;
+	struct {
+		bool enabled;
+		raop_compression_t level;
+		u32_t count, total, max, changes;	// under encoder
+		u32_t late;							// under mutex, like tuning counters
+	} governor;
 	struct alac_codec_s *alac_codec;
 	raop_crypto_t crypto;
 	bool auth;
 	char secret[SECRET_SIZE + 1];
 	char et[16];
 	u8_t md_caps;
+	raop_cache_t cache;
+	char device_id[CACHE_ID_SIZE];
 } raopcl_data_t;
 
 
@@ -200,6 +284,12 @@ static void 	_raopcl_terminate_rtp(struct raopcl_s *p);
 static void 	_raopcl_send_sync(struct raopcl_s *p, bool first);
 static bool 	_raopcl_send_audio(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size);
 static bool 	_raopcl_disconnect(struct raopcl_s *p, bool force);
+static bool 	_raopcl_connect(struct raopcl_s *p, bool set_volume, bool repair);
+static u16_t 	_raopcl_window(struct raopcl_s *p, u64_t *timestamp);
+static void 	_raopcl_send_bulk(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size);
+static void 	_raopcl_resend(struct raopcl_s *p);
+static void 	_raopcl_resend_stop(struct raopcl_s *p);
+static void 	_raopcl_pipeline_clear(struct raopcl_s *p);
 
 // a few accessors
 /*----------------------------------------------------------------------------*/
@@ -251,6 +341,125 @@ u64_t raopcl_time32_to_ntp(u32_t time)
 }
 
 
+/*----------------------------------------------------------------------------*/
+static int _raopcl_packet_size(struct raopcl_s *p)
+{
+	// what one packet costs in the kernel's send queue, roughly
+	return sizeof(rtp_audio_pkt_t) + p->chunk_len * p->channels * p->sample_size / 8 +
+		   SNDBUF_OVERHEAD;
+}
+
+
+/*----------------------------------------------------------------------------*/
+u32_t raopcl_backpressure(struct raopcl_s *p)
+{
+	if (!p || p->outq.sndbuf <= 0 || p->outq.queued <= 0) return 0;
+
+	return min(((u64_t) p->outq.queued * 100) / p->outq.sndbuf, 100);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_get_stats(struct raopcl_s *p, raopcl_stats_t *stats)
+{
+	if (!p || !stats) return false;
+
+	pthread_mutex_lock(&p->mutex);
+	stats->sent = p->tuning.sent;
+	stats->lost = p->tuning.lost;
+	stats->late = p->tuning.late;
+	stats->nack_delay = p->tuning.nack_delay;
+	stats->jitter = p->tuning.jitter;
+	stats->rtt = p->tuning.rtt;
+	stats->latency = p->latency_frames;
+	stats->recommended = p->tuning.recommended;
+	stats->queued = p->outq.queued / _raopcl_packet_size(p);
+	stats->queued_max = p->outq.peak / _raopcl_packet_size(p);
+	stats->backpressure = raopcl_backpressure(p);
+	pthread_mutex_lock(&p->encoder);
+	stats->silent = p->silence.count;
+	stats->compression = p->codec == RAOP_ALAC_RAW ? RAOP_COMPRESS_RAW : p->governor.level;
+	stats->encode_avg = p->governor.count ? p->governor.total / p->governor.count : 0;
+	stats->encode_max = p->governor.max;
+	stats->compression_changes = p->governor.changes;
+	pthread_mutex_unlock(&p->encoder);
+	p->outq.peak = p->outq.queued;
+	pthread_mutex_unlock(&p->mutex);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raopcl_set_latency_tuning(struct raopcl_s *p, raop_tuning_t mode)
+{
+	if (!p) return;
+
+	p->tuning.mode = mode;
+}
+
+
+/*----------------------------------------------------------------------------*/
+u32_t raopcl_recommended_latency(struct raopcl_s *p)
+{
+	if (!p) return 0;
+
+	// same unit as raopcl_latency, so that it can be given to raopcl_set_latency
+	return (p->tuning.recommended ? p->tuning.recommended : p->latency_frames) + RAOP_LATENCY_MIN;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_tune_latency(struct raopcl_s *p)
+{
+	u32_t need, ceiling = MS2TS(LATENCY_MAX_MS, p->sample_rate);
+
+	/*
+	 A retransmit needs the NACK to come back and the packet to go again before
+	 the playtime, so latency must cover the worst NACK delay, the round trip of
+	 the resent packet and the network jitter with some margin. When anything
+	 was too late, grow fast but only shrink slowly (25% per boundary) to avoid
+	 oscillating between sessions
+	*/
+	need = p->tuning.nack_delay + p->tuning.rtt + 2 * p->tuning.jitter + p->chunk_len +
+		   MS2TS(LATENCY_MARGIN_MS, p->sample_rate);
+
+	if (p->tuning.late) need = max(need, p->latency_frames + p->latency_frames / 2);
+	else need = max(need, p->latency_frames - p->latency_frames / 4);
+
+	p->tuning.recommended = min(max(need, p->tuning.floor), ceiling);
+
+	LOG_INFO("[%p]: latency tuning sent:%u lost:%u late:%u nack:%u rtt:%u jitter:%u => %u (current %u)",
+			 p, p->tuning.sent, p->tuning.lost, p->tuning.late, p->tuning.nack_delay,
+			 p->tuning.rtt, p->tuning.jitter, p->tuning.recommended, p->latency_frames);
+
+	if (p->tuning.mode == RAOP_TUNING_APPLY) p->latency_frames = p->tuning.recommended;
+
+	p->tuning.sent = p->tuning.lost = p->tuning.late = 0;
+	p->tuning.nack_delay = 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_set_cache(char *path)
+{
+	return raop_cache_open(path);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_set_device_id(struct raopcl_s *p, char *id)
+{
+	if (!p) return false;
+
+	// an address can be given to another device, so only a real identity is used
+	*p->device_id = '\0';
+	if (id) strncat(p->device_id, id, CACHE_ID_SIZE - 1);
+
+	return true;
+}
+
+
 /*----------------------------------------------------------------------------*/
 bool raopcl_is_connected(struct raopcl_s *p)
 {
@@ -362,6 +571,7 @@ void raopcl_pause(struct raopcl_s *p)
 	pthread_mutex_lock(&p->mutex);
 
 	p->pause_ts = p->head_ts;
+	p->pause_seq = p->seq_number;
 	p->flushing = true;
 
 	pthread_mutex_unlock(&p->mutex);
@@ -370,6 +580,29 @@ void raopcl_pause(struct raopcl_s *p)
 }
 
 
+/*----------------------------------------------------------------------------*/
+bool raopcl_set_latency(struct raopcl_s *p, u32_t latency)
+{
+	bool rc = false;
+
+	if (!p || latency < 2 * RAOP_LATENCY_MIN) return false;
+
+	pthread_mutex_lock(&p->mutex);
+
+	// can't change while packets are stamped with current one
+	if (p->state != RAOP_STREAMING) {
+		p->latency_frames = latency - RAOP_LATENCY_MIN;
+		rc = true;
+	}
+
+	pthread_mutex_unlock(&p->mutex);
+
+	LOG_INFO("[%p]: set latency %u (%s)", p, latency, rc ? "ok" : "streaming");
+
+	return rc;
+}
+
+
 /*----------------------------------------------------------------------------*/
 bool raopcl_start_at(struct raopcl_s *p, u64_t start_time)
 {
@@ -396,15 +629,20 @@ void raopcl_stop(struct raopcl_s *p)
 
 	p->flushing = true;
 	p->pause_ts = 0;
+	p->prefill.lead = 0;
+	p->prefill.burst = false;
 
 	pthread_mutex_unlock(&p->mutex);
+
+	// what was encoded ahead belongs to what is stopped
+	_raopcl_pipeline_clear(p);
 }
 
 
 /*----------------------------------------------------------------------------*/
 bool raopcl_accept_frames(struct raopcl_s *p)
 {
-	bool accept = false, first_pkt = false;
+	bool accept = false, first_pkt = false, resend = false;
 	u64_t now_ts;
 
 	if (!p) return 0;
@@ -434,10 +672,18 @@ bool raopcl_accept_frames(struct raopcl_s *p)
 		if (!p->pause_ts) {
 			p->head_ts = p->first_ts = p->start_ts ? p->start_ts : now_ts;
 			if (first_pkt) _raopcl_send_sync(p, true);
+
+			// player's buffer is empty, fill it now instead of at real-time pace
+			if (p->prefill.enabled && raopcl_latency(p) > p->prefill.margin + p->chunk_len) {
+				p->prefill.lead = raopcl_latency(p) - p->prefill.margin;
+				p->prefill.burst = true;
+				LOG_INFO("[%p]: prefilling %u frames", p, p->prefill.lead);
+			}
 			LOG_INFO("[%p]: restarting w/o pause n:%u.%u, hts:%Lu", p, SECNTP(now), p->head_ts);
 		}
 		else {
-			u16_t n, i, chunks = raopcl_latency(p) / p->chunk_len;
+			// what the player had in its buffer, prefill lead included
+			u16_t n, i, chunks = min((raopcl_latency(p) + p->prefill.lead) / p->chunk_len, MAX_BACKLOG - 1);
 
 			// if un-pausing w/o start_time, can anticipate as we have buffer
 			p->first_ts = p->start_ts ? p->start_ts : now_ts - raopcl_latency(p);
@@ -449,15 +695,19 @@ bool raopcl_accept_frames(struct raopcl_s *p)
 
 			LOG_INFO("[%p]: restarting w/ pause n:%u.%u, hts:%Lu (re-send: %d)", p, SECNTP(now), p->head_ts, chunks);
 
-			// search pause_ts in backlog, it should be backward, not too far
-			for (n = p->seq_number, i = 0;
-				 i < MAX_BACKLOG && p->backlog[n % MAX_BACKLOG].timestamp > p->pause_ts;
-				 i++, n--);
+			// last packet sent before pause, unless the backlog has moved since
+			n = p->pause_seq;
+			if (p->backlog[n % MAX_BACKLOG].seq_number != n || p->backlog[n % MAX_BACKLOG].timestamp > p->pause_ts) {
+				for (n = p->seq_number, i = 0;
+					 i < MAX_BACKLOG && p->backlog[n % MAX_BACKLOG].timestamp > p->pause_ts;
+					 i++, n--);
+			}
 
-			 // the resend shall go up to (including) pause_ts
-			 n = (n - chunks + 1) % MAX_BACKLOG;
+			// the resend shall go up to (including) pause_ts
+			n = (n - chunks + 1) % MAX_BACKLOG;
+			p->resend.seq = p->seq_number + 1;
 
-			// re-send old packets
+			// re-stamp old packets, they'll be sent in background
 			for (i = 0; i < chunks; i++) {
 				rtp_audio_pkt_t *packet;
 				u16_t reindex, index = (n + i) % MAX_BACKLOG;
@@ -484,11 +734,10 @@ bool raopcl_accept_frames(struct raopcl_s *p)
 				p->backlog[index].buffer = NULL;
 
 				p->head_ts += p->chunk_len;
-
-				_raopcl_send_audio(p, packet, p->backlog[reindex].size);
 			}
 
-			LOG_DEBUG("[%p]: finished resend %u", p, i);
+			p->resend.count = p->seq_number - p->resend.seq + 1;
+			resend = true;
 		}
 
 		p->pause_ts = p->start_ts = 0;
@@ -497,71 +746,324 @@ bool raopcl_accept_frames(struct raopcl_s *p)
 
 	// when paused, fix "now" at the time when it was paused.
 	if (p->pause_ts) now_ts = p->pause_ts;
-	else now_ts = NTP2TS(get_ntp(NULL), p->sample_rate);
+	else now_ts = NTP2TS(get_ntp(NULL), p->sample_rate) + p->txtime.lead + p->prefill.lead;
 
 	if (now_ts >= p->head_ts + p->chunk_len) accept = true;
 
 	pthread_mutex_unlock(&p->mutex);
 
+	if (resend) _raopcl_resend(p);
+
 	return accept;
 }
 
 
 /*----------------------------------------------------------------------------*/
-bool raopcl_send_chunk(struct raopcl_s *p, u8_t *sample, int frames, u64_t *playtime)
+static void _raopcl_swap16(u8_t *dst, u8_t *src, int frames)
 {
-	u8_t *encoded, *buffer;
-	rtp_audio_pkt_t *packet;
-	size_t n;
-	int size;
-	u64_t now = get_ntp(NULL);
+	// 2 channels of 16 bits, works in place as well
+	for (frames *= 2; frames--; src += 2, dst += 2) {
+		u8_t c = *src;
+		*dst = *(src + 1);
+		*(dst + 1) = c;
+	}
+}
 
-	if (!p || !sample) {
-		LOG_ERROR("[%p]: something went wrong (s:%p)", p, sample);
+
+/*----------------------------------------------------------------------------*/
+static int _raopcl_input_bytes(struct raopcl_s *p)
+{
+	switch (p->input) {
+		case RAOP_INPUT_S24LE: return 3;
+		case RAOP_INPUT_S32LE:
+		case RAOP_INPUT_F32: return 4;
+		default: return 2;
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _raopcl_check_input(struct raopcl_s *p, int frames)
+{
+	if (p->planar && frames > p->chunk_len) {
+		LOG_ERROR("[%p]: planar input of %d frames above %d", p, frames, p->chunk_len);
 		return false;
 	}
 
-	pthread_mutex_lock(&p->mutex);
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static inline s32_t _raopcl_reduce(s64_t v, u32_t *r)
+{
+	// digital silence is not dithered, so it stays silent
+	if (v) {
+		u32_t x = *r;
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		v += (s32_t) (x & 0xffff) - (s32_t) (x >> 16) + 0x8000;
+		*r = x;
+	}
+
+	v >>= 16;
+
+	return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static inline void _raopcl_put16(u8_t *dst, s32_t v, bool be)
+{
+	if (be) {
+		dst[0] = (u16_t) v >> 8;
+		dst[1] = (u8_t) v;
+	} else {
+		dst[0] = (u8_t) v;
+		dst[1] = (u16_t) v >> 8;
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_convert(struct raopcl_s *p, u8_t *sample, int frames, u8_t *dst, bool be)
+{
+	int bytes = _raopcl_input_bytes(p);
+	int i, c, step = p->planar ? bytes : bytes * p->channels;
+	int stride = p->planar ? frames * bytes : bytes;
+	int inc = p->channels * 2;
+	u32_t r = p->dither;
 
 	/*
-	 Move to streaming state only when really flushed. In most cases, this is
-	 done by the raopcl_accept_frames function, except when a player takes too
-	 long to flush (JBL OnBeat) and we have to "fake" accepting frames
+	 Single pass from whatever input to 16 bits interleaved in the order the
+	 codec wants (network order for PCM, host order for ALAC). There is one
+	 loop per input format and per channel so that nothing is decided per
+	 sample: 16 bits inputs are a plain copy the compiler can vectorize, the
+	 others are brought to 32 bits then reduced with a TPDF dither (+/- 1 LSB)
+	 made of the two halves of a xorshift draw. Inputs may not be aligned, so
+	 wider words are read with memcpy
 	*/
-	if (p->state == RAOP_FLUSHED) {
-		p->first_pkt = true;
-		LOG_INFO("[%p]: begining to stream (LATE) hts:%Lu n:%u.%u", p, p->head_ts, SECNTP(now));
-		p->state = RAOP_STREAMING;
-		_raopcl_send_sync(p, true);
+	for (c = 0; c < p->channels; c++) {
+		u8_t *in = sample + c * stride, *out = dst + c * 2;
+
+		switch (p->input) {
+			case RAOP_INPUT_S24LE:
+				for (i = 0; i < frames; i++, in += step, out += inc) {
+					s32_t v = (s32_t) ((in[0] << 8) | (in[1] << 16) | ((u32_t) in[2] << 24));
+					_raopcl_put16(out, _raopcl_reduce(v, &r), be);
+				}
+				break;
+			case RAOP_INPUT_S32LE:
+				for (i = 0; i < frames; i++, in += step, out += inc) {
+					s32_t v;
+					memcpy(&v, in, sizeof(v));
+					_raopcl_put16(out, _raopcl_reduce(v, &r), be);
+				}
+				break;
+			case RAOP_INPUT_F32:
+				for (i = 0; i < frames; i++, in += step, out += inc) {
+					float f;
+					s64_t v;
+
+					memcpy(&f, in, sizeof(f));
+					// NaN can't be converted, it's silence
+					if (!(f == f)) f = 0;
+					v = f >= 1.0f ? 0x7fffffff : f <= -1.0f ? -0x7fffffffLL - 1 : (s64_t) (f * 2147483648.0f);
+					_raopcl_put16(out, _raopcl_reduce(v, &r), be);
+				}
+				break;
+			case RAOP_INPUT_S16BE:
+				for (i = 0; i < frames; i++, in += step, out += inc) {
+					_raopcl_put16(out, (s16_t) ((in[0] << 8) | in[1]), be);
+				}
+				break;
+			default:
+				for (i = 0; i < frames; i++, in += step, out += inc) {
+					_raopcl_put16(out, (s16_t) ((in[1] << 8) | in[0]), be);
+				}
+				break;
+		}
+	}
+
+	p->dither = r;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _raopcl_encode_payload(struct raopcl_s *p, u8_t *sample, int frames, u8_t **out, int *size)
+{
+	u8_t *encoded = NULL;
+	bool native = !p->planar && p->input <= RAOP_INPUT_S16BE;
+
+	// PCM is written straight in network order, no intermediate buffer
+	if (p->codec == RAOP_PCM && !native) {
+		*size = frames * p->channels * 2;
+		if ((encoded = malloc(*size)) != NULL) _raopcl_convert(p, sample, frames, encoded, true);
+		*out = encoded;
+		return encoded != NULL;
+	}
+
+	// encoders want interleaved 16 bits little endian, staged once per session
+	if (p->codec != RAOP_PCM && (!native || p->input == RAOP_INPUT_S16BE)) {
+		if (!p->staging && (p->staging = malloc(p->chunk_len * p->channels * 2)) == NULL) return false;
+		if (native) _raopcl_swap16(p->staging, sample, frames);
+		else _raopcl_convert(p, sample, frames, p->staging, false);
+		sample = p->staging;
 	}
 
 	switch (p->codec) {
 		case RAOP_ALAC:
-			pcm_to_alac(p->alac_codec, sample, frames, &encoded, &size);
-			break;
-		case RAOP_ALAC_RAW:
-			pcm_to_alac_raw(sample, frames, &encoded, &size, p->chunk_len);
-			break;
-		case RAOP_PCM: {
-			u8_t *src = sample, *dst = encoded = malloc(frames * 4);
-			for (size = 0; size < frames; size++) {
-				*dst++ = *(src + 1); *dst++ = *src++;
-				*dst++ = *(++src + 1); *dst++ = *src++;
-				src++;
-			}
-			size *= 4;
+		case RAOP_ALAC_RAW: {
+			u64_t start = get_ntp(NULL);
+			u32_t elapsed;
+
+			if (p->codec == RAOP_ALAC) pcm_to_alac(p->alac_codec, sample, frames, &encoded, size);
+			else pcm_to_alac_raw(sample, frames, &encoded, size, p->chunk_len);
+
+			// what the governor needs (in us)
+			elapsed = ((get_ntp(NULL) - start) * 1000000) >> 32;
+			p->governor.total += elapsed;
+			p->governor.max = max(p->governor.max, elapsed);
+			p->governor.count++;
 			break;
 		}
+		case RAOP_PCM:
+			*size = frames * 4;
+			if ((encoded = malloc(*size)) == NULL) break;
+			if (p->input == RAOP_INPUT_S16BE) memcpy(encoded, sample, *size);
+			else _raopcl_swap16(encoded, sample, frames);
+			break;
 		default:
 			LOG_ERROR("[%p]: don't know what we're doing here", p);
-			return false;
+			break;
 	}
 
+	*out = encoded;
+
+	return encoded != NULL;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static u8_t *_raopcl_make_packet(struct raopcl_s *p, u8_t *encoded, int size)
+{
+	u8_t *buffer;
+
+	// packet is after re-transmit header
 	if ((buffer = malloc(sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t) + size)) == NULL) {
-		pthread_mutex_unlock(&p->mutex);
-		if (encoded) free(encoded);
 		LOG_ERROR("[%p]: cannot allocate buffer",p);
-		return false;
+		return NULL;
+	}
+
+	memcpy(buffer + sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t), encoded, size);
+
+	// with newer airport express, don't use encryption (??)
+	if (p->encrypt) raopcl_encrypt(p, buffer + sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t), size);
+
+	return buffer;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _raopcl_silent(u8_t *sample, int size)
+{
+	u64_t acc = 0, w[8];
+	int i;
+
+	// whole blocks are OR'ed (vectorizable) and only checked once per block
+	for (; size >= (int) sizeof(w); size -= sizeof(w), sample += sizeof(w)) {
+		memcpy(w, sample, sizeof(w));
+		for (i = 0; i < 8; i++) acc |= w[i];
+		if (acc) return false;
+	}
+
+	while (size--) acc |= *sample++;
+
+	return !acc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static u8_t *_raopcl_silence_packet(struct raopcl_s *p, u8_t *sample, int frames, int *size)
+{
+	u8_t *encoded, *buffer;
+
+	/*
+	 The IV is reset for every packet, so the encrypted payload of a given
+	 length of silence never changes during a session. It's built once then
+	 copied in new packets, skipping both encoding and encryption. Zero input
+	 is never dithered so that payload is true silence, not a frozen noise
+	*/
+	if (p->silence.payload && p->silence.frames == frames) {
+		if ((buffer = malloc(sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t) + p->silence.size)) == NULL) return NULL;
+		memcpy(buffer + sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t), p->silence.payload, p->silence.size);
+		*size = p->silence.size;
+		p->silence.count++;
+		return buffer;
+	}
+
+	if (!_raopcl_encode_payload(p, sample, frames, &encoded, size)) return NULL;
+	buffer = _raopcl_make_packet(p, encoded, *size);
+	free(encoded);
+
+	if (!buffer) return NULL;
+
+	// remember what has been made for that length
+	if (p->silence.payload) free(p->silence.payload);
+	if ((p->silence.payload = malloc(*size)) != NULL) {
+		memcpy(p->silence.payload, buffer + sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t), *size);
+		p->silence.frames = frames;
+		p->silence.size = *size;
+	}
+
+	return buffer;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_silence_clear(struct raopcl_s *p)
+{
+	if (p->silence.payload) free(p->silence.payload);
+	p->silence.payload = NULL;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static u8_t *_raopcl_encode(struct raopcl_s *p, u8_t *sample, int frames, int *size)
+{
+	u8_t *encoded, *buffer = NULL;
+
+	// pipeline encodes outside main mutex, codec & format can't change meanwhile
+	pthread_mutex_lock(&p->encoder);
+
+	if (_raopcl_silent(sample, frames * p->channels * _raopcl_input_bytes(p))) {
+		buffer = _raopcl_silence_packet(p, sample, frames, size);
+	} else if (_raopcl_encode_payload(p, sample, frames, &encoded, size)) {
+		buffer = _raopcl_make_packet(p, encoded, *size);
+		free(encoded);
+	}
+
+	pthread_mutex_unlock(&p->encoder);
+
+	return buffer;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_packetize(struct raopcl_s *p, u8_t *buffer, int size, u64_t now, u64_t *playtime)
+{
+	rtp_audio_pkt_t *packet;
+	size_t n;
+
+	/*
+	 Move to streaming state only when really flushed. In most cases, this is
+	 done by the raopcl_accept_frames function, except when a player takes too
+	 long to flush (JBL OnBeat) and we have to "fake" accepting frames
+	*/
+	if (p->state == RAOP_FLUSHED) {
+		p->first_pkt = true;
+		LOG_INFO("[%p]: begining to stream (LATE) hts:%Lu n:%u.%u", p, p->head_ts, SECNTP(now));
+		p->state = RAOP_STREAMING;
+		_raopcl_send_sync(p, true);
 	}
 
 	*playtime = TS2NTP(p->head_ts + raopcl_latency(p), p->sample_rate);
@@ -570,7 +1072,7 @@ bool raopcl_send_chunk(struct raopcl_s *p, u8_t *sample, int frames, u64_t *play
 
 	p->seq_number++;
 
-	// packet is after re-transmit header
+	// payload is already there (and encrypted), only header is left
 	packet = (rtp_audio_pkt_t *) (buffer + sizeof(rtp_header_t));
 	packet->hdr.proto = 0x80;
 	packet->hdr.type = 0x60 | (p->first_pkt ? 0x80 : 0);
@@ -580,11 +1082,6 @@ bool raopcl_send_chunk(struct raopcl_s *p, u8_t *sample, int frames, u64_t *play
 	packet->timestamp = htonl(p->head_ts);
 	packet->ssrc = htonl(p->ssrc);
 
-	memcpy((u8_t*) packet + sizeof(rtp_audio_pkt_t), encoded, size);
-
-	// with newer airport express, don't use encryption (??)
-	if (p->encrypt) raopcl_encrypt(p, (u8_t*) packet + sizeof(rtp_audio_pkt_t), size);
-
 	n = p->seq_number % MAX_BACKLOG;
 	p->backlog[n].seq_number = p->seq_number;
 	p->backlog[n].timestamp = p->head_ts;
@@ -593,32 +1090,754 @@ bool raopcl_send_chunk(struct raopcl_s *p, u8_t *sample, int frames, u64_t *play
 	p->backlog[n].size = sizeof(rtp_audio_pkt_t) + size;
 
 	p->head_ts += p->chunk_len;
+	p->tuning.sent++;
 
-	_raopcl_send_audio(p, packet, sizeof(rtp_audio_pkt_t) + size);
+	// initial prefill burst is over once the lead has been reached
+	if (p->prefill.burst && p->backlog[n].timestamp + p->chunk_len >= NTP2TS(now, p->sample_rate) + p->prefill.lead) {
+		p->prefill.burst = false;
+	}
 
-	pthread_mutex_unlock(&p->mutex);
+	// only that burst can wait a bit for others, never real-time or launch-time paced
+	if (p->prefill.burst && p->txtime.clock == -1) {
+		_raopcl_send_bulk(p, packet, sizeof(rtp_audio_pkt_t) + size);
+	} else {
+		_raopcl_send_audio(p, packet, sizeof(rtp_audio_pkt_t) + size);
+	}
 
 	if (NTP2MS(*playtime) % 10000 < 8) {
 		LOG_INFO("[%p]: check n:%u p:%u ts:%Lu sn:%u\n               "
-				  "retr: %u, avail: %u, send: %u, select: %u)", p,
+				  "retr: %u, avail: %u, send: %u, select: %u, queued: %u%%)", p,
 				 MSEC(now), MSEC(*playtime), p->head_ts, p->seq_number,
 				 p->retransmit, p->sane.audio.avail, p->sane.audio.send,
-				 p->sane.audio.select);
+				 p->sane.audio.select, raopcl_backpressure(p));
 	}
-
-	if (encoded) free(encoded);
-
-	return true;
 }
 
 
 /*----------------------------------------------------------------------------*/
-bool _raopcl_send_audio(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size)
+bool raopcl_send_chunk(struct raopcl_s *p, u8_t *sample, int frames, u64_t *playtime)
 {
-	struct timeval timeout;
-	fd_set wfds;
-	struct sockaddr_in addr;
-	size_t n;
+	u8_t *buffer;
+	int size;
+	u64_t now = get_ntp(NULL);
+
+	if (!p || !sample) {
+		LOG_ERROR("[%p]: something went wrong (s:%p)", p, sample);
+		return false;
+	}
+
+	if (!_raopcl_check_input(p, frames)) return false;
+
+	// never more than what the player expects in one packet
+	frames = min(frames, p->chunk_len);
+
+	pthread_mutex_lock(&p->mutex);
+
+	if ((buffer = _raopcl_encode(p, sample, frames, &size)) == NULL) {
+		pthread_mutex_unlock(&p->mutex);
+		return false;
+	}
+
+	_raopcl_packetize(p, buffer, size, now, playtime);
+
+	pthread_mutex_unlock(&p->mutex);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _raopcl_pipeline_encode(struct raopcl_s *p)
+{
+	u32_t generation = p->pipeline.generation;
+	int index, size;
+	u8_t *buffer;
+
+	// called with pipeline's mutex, returns false when nothing to encode
+	if (!p->pipeline.running || p->pipeline.ready == p->pipeline.count) return false;
+
+	index = (p->pipeline.head + p->pipeline.ready) % p->pipeline.depth;
+
+	// encoding holds the encoder lock only, codec & format are stable meanwhile
+	pthread_mutex_unlock(&p->pipeline.mutex);
+	buffer = _raopcl_encode(p, p->pipeline.slots[index].pcm, p->pipeline.slots[index].frames, &size);
+	pthread_mutex_lock(&p->pipeline.mutex);
+
+	// queue has been cleared meanwhile
+	if (generation != p->pipeline.generation) {
+		if (buffer) free(buffer);
+		return true;
+	}
+
+	p->pipeline.slots[index].buffer = buffer;
+	p->pipeline.slots[index].size = size;
+	p->pipeline.ready++;
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_same_encoding(struct raopcl_s *a, struct raopcl_s *b)
+{
+	raop_codec_t codec;
+	bool same;
+
+	if (!a || !b) return false;
+
+	// the governor may change the codec at flush, one encoder lock at a time
+	pthread_mutex_lock(&a->encoder);
+	codec = a->codec;
+	pthread_mutex_unlock(&a->encoder);
+
+	pthread_mutex_lock(&b->encoder);
+	same = b->codec == codec;
+	pthread_mutex_unlock(&b->encoder);
+
+	return same && a->chunk_len == b->chunk_len &&
+		   a->sample_rate == b->sample_rate && a->sample_size == b->sample_size &&
+		   a->channels == b->channels;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_encode_chunk(struct raopcl_s *p, u8_t *sample, int frames, u8_t **payload, int *size)
+{
+	bool rc;
+
+	if (!p || !sample || !_raopcl_check_input(p, frames)) return false;
+
+	pthread_mutex_lock(&p->mutex);
+	pthread_mutex_lock(&p->encoder);
+	rc = _raopcl_encode_payload(p, sample, min(frames, p->chunk_len), payload, size);
+	pthread_mutex_unlock(&p->encoder);
+	pthread_mutex_unlock(&p->mutex);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_send_payload(struct raopcl_s *p, u8_t *payload, int size, u64_t *playtime)
+{
+	u64_t now = get_ntp(NULL);
+	u8_t *buffer;
+
+	if (!p || !payload) return false;
+
+	// only the encryption is per player
+	pthread_mutex_lock(&p->mutex);
+	pthread_mutex_lock(&p->encoder);
+	buffer = _raopcl_make_packet(p, payload, size);
+	pthread_mutex_unlock(&p->encoder);
+
+	if (!buffer) {
+		pthread_mutex_unlock(&p->mutex);
+		return false;
+	}
+
+	_raopcl_packetize(p, buffer, size, now, playtime);
+
+	pthread_mutex_unlock(&p->mutex);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_set_input(struct raopcl_s *p, raop_input_t input, bool planar)
+{
+	if (!p) return false;
+
+	pthread_mutex_lock(&p->mutex);
+	pthread_mutex_lock(&p->encoder);
+	p->input = input;
+	p->planar = planar;
+	pthread_mutex_unlock(&p->encoder);
+	pthread_mutex_unlock(&p->mutex);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+u8_t *raopcl_get_buffer(struct raopcl_s *p, int *frames)
+{
+	u8_t *buffer = NULL;
+	int size;
+	u16_t n;
+
+	if (!p) return NULL;
+
+	pthread_mutex_lock(&p->mutex);
+	pthread_mutex_lock(&p->encoder);
+
+	if (p->codec != RAOP_PCM || p->input != RAOP_INPUT_S16BE || p->planar) goto exit;
+
+	size = sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t) + p->chunk_len * 4;
+
+	/*
+	 Recycle the oldest backlog packet, which is the slot the next packet will
+	 take anyway (re-transmit of a missing backlog packet is just skipped). All
+	 users of backlog copy it under the mutex, but a packet that the resend
+	 thread has still to send is left alone
+	*/
+	if (!p->direct.buffer) {
+		n = (p->seq_number + 1) % MAX_BACKLOG;
+
+		if (p->backlog[n].buffer && (int) sizeof(rtp_header_t) + p->backlog[n].size >= size &&
+			(!p->resend.running || (u16_t) (p->backlog[n].seq_number - p->resend.seq) >= p->resend.count)) {
+			p->direct.buffer = p->backlog[n].buffer;
+			p->backlog[n].buffer = NULL;
+		} else {
+			p->direct.buffer = malloc(size);
+		}
+	}
+
+	buffer = p->direct.buffer;
+
+exit:
+	pthread_mutex_unlock(&p->encoder);
+	pthread_mutex_unlock(&p->mutex);
+
+	if (!buffer) return NULL;
+
+	*frames = p->chunk_len;
+
+	return buffer + sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_commit_buffer(struct raopcl_s *p, int frames, u64_t *playtime)
+{
+	u64_t now = get_ntp(NULL);
+
+	if (!p || frames <= 0) return false;
+
+	pthread_mutex_lock(&p->mutex);
+
+	if (!p->direct.buffer) {
+		pthread_mutex_unlock(&p->mutex);
+		return false;
+	}
+
+	frames = min(frames, p->chunk_len);
+
+	// encryption is done in place
+	if (p->encrypt) raopcl_encrypt(p, p->direct.buffer + sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t), frames * 4);
+
+	// backlog now owns the buffer
+	_raopcl_packetize(p, p->direct.buffer, frames * 4, now, playtime);
+	p->direct.buffer = NULL;
+
+	pthread_mutex_unlock(&p->mutex);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_check_alac_cookie(struct raopcl_s *p, u8_t *cookie, int size)
+{
+	struct alac_codec_s *codec;
+	u8_t sample_size, channels;
+	unsigned sample_rate, frame_length;
+
+	if (!p || !cookie || (codec = alac_create_decoder(size, cookie, &sample_size, &sample_rate, &channels)) == NULL) return false;
+
+	frame_length = alac_frame_length(codec);
+	alac_delete_decoder(codec);
+
+	if (sample_size != p->sample_size || sample_rate != (unsigned) p->sample_rate ||
+		channels != p->channels || frame_length != (unsigned) p->chunk_len) {
+		LOG_ERROR("[%p]: ALAC source (%u/%u/%u/%u) does not match session (%u/%u/%u/%u)", p,
+				  sample_size, sample_rate, channels, frame_length,
+				  p->sample_size, p->sample_rate, p->channels, p->chunk_len);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static int _raopcl_alac_frames(struct raopcl_s *p, u8_t *frame, int size)
+{
+	/*
+	 ALAC frame header: element tag (3), instance (4), unused (12), partial (1),
+	 shift (2), escape (1) then number of samples (32) when partial is set
+	*/
+	if (size < 3 || (frame[0] >> 5) != (p->channels == 2 ? 1 : 0)) return -1;
+	if (!(frame[2] & 0x10)) return p->chunk_len;
+	if (size < 7) return -1;
+
+	return ((frame[2] & 0x01) << 31) | (frame[3] << 23) | (frame[4] << 15) |
+		   (frame[5] << 7) | (frame[6] >> 1);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_send_encoded(struct raopcl_s *p, u8_t *frame, int size, int frames, u64_t *playtime)
+{
+	int count;
+
+	if (!p || !frame) return false;
+
+	if (p->codec != RAOP_ALAC && p->codec != RAOP_ALAC_RAW) {
+		LOG_ERROR("[%p]: ALAC passthrough with a non-ALAC session", p);
+		return false;
+	}
+
+	// receiver decodes with session's SDP, so frame must fit it
+	count = _raopcl_alac_frames(p, frame, size);
+
+	if (count != frames || frames <= 0 || frames > (int) p->chunk_len) {
+		LOG_ERROR("[%p]: invalid ALAC frame (size:%d frames:%d/%d)", p, size, frames, count);
+		return false;
+	}
+
+	return raopcl_send_payload(p, frame, size, playtime);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void *_raopcl_pipeline_thread(void *args)
+{
+	struct raopcl_s *p = (struct raopcl_s*) args;
+
+	pthread_mutex_lock(&p->pipeline.mutex);
+
+	while (p->pipeline.running) {
+		if (!_raopcl_pipeline_encode(p)) pthread_cond_wait(&p->pipeline.cond, &p->pipeline.mutex);
+	}
+
+	pthread_mutex_unlock(&p->pipeline.mutex);
+
+	return NULL;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_pipeline_job(void *arg)
+{
+	struct raopcl_s *p = (struct raopcl_s*) arg;
+
+	// a job encodes whatever is pending, so only one per session is needed
+	pthread_mutex_lock(&p->pipeline.mutex);
+	while (_raopcl_pipeline_encode(p));
+	p->pipeline.busy = false;
+	pthread_cond_broadcast(&p->pipeline.cond);
+	pthread_mutex_unlock(&p->pipeline.mutex);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_pipeline_submit(struct raopcl_s *p)
+{
+	u64_t deadline;
+
+	// called with pipeline's mutex
+	if (p->pipeline.busy) return;
+
+	// the first non-encoded chunk is needed once the ready ones have been sent
+	deadline = get_ntp(NULL) + TS2NTP(p->pipeline.ready * p->chunk_len, p->sample_rate);
+	p->pipeline.busy = true;
+
+	if (!raop_pool_submit(_raopcl_pipeline_job, p, deadline)) {
+		LOG_WARN("[%p]: cannot submit to pool, encoding in place", p);
+		while (_raopcl_pipeline_encode(p));
+		p->pipeline.busy = false;
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_pipeline_clear(struct raopcl_s *p)
+{
+	int i;
+
+	if (!p->pipeline.depth) return;
+
+	pthread_mutex_lock(&p->pipeline.mutex);
+
+	for (i = 0; i < p->pipeline.depth; i++) {
+		if (p->pipeline.slots[i].buffer) free(p->pipeline.slots[i].buffer);
+		p->pipeline.slots[i].buffer = NULL;
+	}
+
+	p->pipeline.head = p->pipeline.count = p->pipeline.ready = 0;
+	p->pipeline.generation++;
+
+	pthread_mutex_unlock(&p->pipeline.mutex);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_pipeline_stop(struct raopcl_s *p)
+{
+	int i;
+
+	if (!p->pipeline.depth) return;
+
+	pthread_mutex_lock(&p->pipeline.mutex);
+	p->pipeline.running = false;
+	pthread_cond_signal(&p->pipeline.cond);
+
+	// a job not started yet is simply removed, a running one is waited for
+	if (p->pipeline.pooled) {
+		if (raop_pool_cancel(p)) p->pipeline.busy = false;
+		while (p->pipeline.busy) pthread_cond_wait(&p->pipeline.cond, &p->pipeline.mutex);
+	}
+
+	pthread_mutex_unlock(&p->pipeline.mutex);
+
+	if (p->pipeline.pooled) raop_pool_detach(p);
+	else pthread_join(p->pipeline.thread, NULL);
+
+	_raopcl_pipeline_clear(p);
+
+	for (i = 0; i < p->pipeline.depth; i++) free(p->pipeline.slots[i].pcm);
+	free(p->pipeline.slots);
+	pthread_mutex_destroy(&p->pipeline.mutex);
+	pthread_cond_destroy(&p->pipeline.cond);
+
+	LOG_INFO("[%p]: pipeline stopped (underruns:%u)", p, p->pipeline.underruns);
+
+	memset(&p->pipeline, 0, sizeof(p->pipeline));
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_set_pipeline(struct raopcl_s *p, int depth)
+{
+	int i;
+
+	if (!p) return false;
+
+	_raopcl_pipeline_stop(p);
+
+	if (depth <= 0) return true;
+
+	if (depth > MAX_BACKLOG / 2) {
+		LOG_ERROR("[%p]: pipeline depth %d above %d", p, depth, MAX_BACKLOG / 2);
+		return false;
+	}
+
+	if ((p->pipeline.slots = calloc(depth, sizeof(*p->pipeline.slots))) == NULL) return false;
+
+	for (i = 0; i < depth; i++) {
+		if ((p->pipeline.slots[i].pcm = malloc(p->chunk_len * p->channels * 4)) != NULL) continue;
+		while (i--) free(p->pipeline.slots[i].pcm);
+		free(p->pipeline.slots);
+		p->pipeline.slots = NULL;
+		return false;
+	}
+
+	pthread_mutex_init(&p->pipeline.mutex, NULL);
+	pthread_cond_init(&p->pipeline.cond, NULL);
+	p->pipeline.depth = depth;
+	p->pipeline.running = true;
+
+	// use shared workers when there are some
+	p->pipeline.pooled = raop_pool_attach(p);
+	if (!p->pipeline.pooled) pthread_create(&p->pipeline.thread, NULL, _raopcl_pipeline_thread, (void*) p);
+
+	LOG_INFO("[%p]: encoding %d packets ahead (%s)", p, depth, p->pipeline.pooled ? "pool" : "thread");
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_queue_chunk(struct raopcl_s *p, u8_t *sample, int frames)
+{
+	int index;
+
+	if (!p || !sample || !p->pipeline.depth || !_raopcl_check_input(p, frames)) return false;
+
+	pthread_mutex_lock(&p->pipeline.mutex);
+
+	if (p->pipeline.count == p->pipeline.depth) {
+		pthread_mutex_unlock(&p->pipeline.mutex);
+		return false;
+	}
+
+	index = (p->pipeline.head + p->pipeline.count) % p->pipeline.depth;
+	p->pipeline.slots[index].frames = min(frames, p->chunk_len);
+	memcpy(p->pipeline.slots[index].pcm, sample, p->pipeline.slots[index].frames * p->channels * _raopcl_input_bytes(p));
+	p->pipeline.count++;
+
+	if (p->pipeline.pooled) _raopcl_pipeline_submit(p);
+	else pthread_cond_signal(&p->pipeline.cond);
+
+	pthread_mutex_unlock(&p->pipeline.mutex);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_send_queued(struct raopcl_s *p, u64_t *playtime)
+{
+	u64_t now = get_ntp(NULL);
+	u8_t *buffer;
+	int size;
+
+	if (!p || !p->pipeline.depth) return false;
+
+	pthread_mutex_lock(&p->pipeline.mutex);
+
+	if (!p->pipeline.ready) {
+		if (p->pipeline.count) p->pipeline.underruns++;
+		pthread_mutex_unlock(&p->pipeline.mutex);
+		return false;
+	}
+
+	buffer = p->pipeline.slots[p->pipeline.head].buffer;
+	size = p->pipeline.slots[p->pipeline.head].size;
+	p->pipeline.slots[p->pipeline.head].buffer = NULL;
+	p->pipeline.head = (p->pipeline.head + 1) % p->pipeline.depth;
+	p->pipeline.count--;
+	p->pipeline.ready--;
+	pthread_cond_signal(&p->pipeline.cond);
+
+	pthread_mutex_unlock(&p->pipeline.mutex);
+
+	// encoding failed, drop that one
+	if (!buffer) return false;
+
+	pthread_mutex_lock(&p->mutex);
+	_raopcl_packetize(p, buffer, size, now, playtime);
+	pthread_mutex_unlock(&p->mutex);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+int raopcl_queued_chunks(struct raopcl_s *p)
+{
+	if (!p || !p->pipeline.depth) return 0;
+
+	return p->pipeline.count;
+}
+
+
+#if LINUX
+/*----------------------------------------------------------------------------*/
+static ssize_t _raopcl_send_txtime(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size)
+{
+	struct timespec ts;
+	u32_t now_ts = NTP2TS(get_ntp(NULL), p->sample_rate);
+	u64_t txtime;
+	s64_t delta;
+
+	/*
+	 The ideal send instant of a packet is when the real-time pacing would have
+	 accepted it (now_ts = timestamp + chunk_len), so convert that in the clock
+	 used by the qdisc. Late packets (re-send, no lead) are sent asap.
+	*/
+	delta = (s32_t) (ntohl(packet->timestamp) + p->chunk_len - p->prefill.lead - now_ts);
+	delta = (delta * 1000000000LL) / p->sample_rate;
+
+	clock_gettime(p->txtime.clock, &ts);
+	txtime = (u64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	txtime += max(delta, TXTIME_MIN_NS);
+
+	// launch time refused by the qdisc, fallback to user-space pacing for good
+	if (++p->txtime.count % TXTIME_CHECK == 0 && txtime_errors(p->rtp_ports.audio.fd)) {
+		LOG_WARN("[%p]: SO_TXTIME errors, back to user-space pacing", p);
+		disable_txtime(p->rtp_ports.audio.fd, p->txtime.clock);
+		p->txtime.lead = 0;
+		p->txtime.clock = -1;
+		return send(p->rtp_ports.audio.fd, (void*) packet, size, 0);
+	}
+
+	return send_txtime(p->rtp_ports.audio.fd, (void*) packet, size, NULL, txtime);
+}
+#endif
+
+
+/*----------------------------------------------------------------------------*/
+static bool _raopcl_connect_audio(struct raopcl_s *p)
+{
+	struct sockaddr_in addr;
+
+	// audio goes always to the same place, so let the socket know it once
+	addr.sin_family = AF_INET;
+	addr.sin_addr = p->host_addr;
+	addr.sin_port = htons(p->rtp_ports.audio.rport);
+
+	if (connect(p->rtp_ports.audio.fd, (struct sockaddr*) &addr, sizeof(addr))) {
+		LOG_ERROR("[%p]: cannot connect audio socket %s", p, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_set_txtime(struct raopcl_s *p)
+{
+	p->txtime.clock = -1;
+	p->txtime.lead = 0;
+
+#if LINUX
+	if (p->txtime.horizon && p->rtp_ports.audio.fd != -1) {
+		struct in_addr local;
+
+		local.s_addr = inet_addr(rtspcl_local_ip(p->rtspcl));
+		p->txtime.clock = enable_txtime(p->rtp_ports.audio.fd, local);
+		if (p->txtime.clock != -1) p->txtime.lead = p->txtime.horizon;
+	}
+#endif
+
+	LOG_INFO("[%p]: launch time pacing %s", p, p->txtime.lead ? "enabled" : "disabled");
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_set_sndbuf(struct raopcl_s *p)
+{
+	p->outq.queued = p->outq.peak = 0;
+	p->outq.tune.peak = p->outq.tune.samples = 0;
+	p->outq.tune.full = false;
+
+	if (p->rtp_ports.audio.fd == -1) return;
+
+	p->outq.sndbuf = set_sndbuf(p->rtp_ports.audio.fd, p->outq.periods * _raopcl_packet_size(p));
+
+	LOG_INFO("[%p]: audio send buffer %d bytes (~%d packets)", p, p->outq.sndbuf,
+			 p->outq.sndbuf / _raopcl_packet_size(p));
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_sample_outq(struct raopcl_s *p, bool full)
+{
+	int queued = socket_outq(p->rtp_ports.audio.fd);
+	u32_t periods = p->outq.periods;
+
+	if (queued < 0) return;
+
+	p->outq.queued = queued;
+	if (queued > p->outq.peak) p->outq.peak = queued;
+
+	if (!p->outq.tune.enabled || p->outq.sndbuf <= 0) return;
+
+	p->outq.tune.full |= full;
+	if (queued > p->outq.tune.peak) p->outq.tune.peak = queued;
+	if (++p->outq.tune.samples < OUTQ_TUNE) return;
+
+	/*
+	 Over the last window, a buffer that has been filled (or close to) is too
+	 small for the bursts of this link and is doubled. One that never got past
+	 1/8th only delays congestion signals and retransmits, so it's halved
+	*/
+	if (p->outq.tune.full || p->outq.tune.peak > p->outq.sndbuf / 4 * 3) {
+		periods = min(periods * 2, OUTQ_MAX_PERIODS);
+	} else if (p->outq.tune.peak < p->outq.sndbuf / 8) {
+		periods = max(periods / 2, OUTQ_MIN_PERIODS);
+	}
+
+	if (periods != p->outq.periods) {
+		LOG_INFO("[%p]: send buffer peak %d/%d bytes%s, %u => %u packets", p, p->outq.tune.peak,
+				 p->outq.sndbuf, p->outq.tune.full ? " (full)" : "", p->outq.periods, periods);
+		p->outq.periods = periods;
+		_raopcl_set_sndbuf(p);
+	} else {
+		p->outq.tune.peak = p->outq.tune.samples = 0;
+		p->outq.tune.full = false;
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_set_sndbuf(struct raopcl_s *p, u32_t periods)
+{
+	bool rc;
+
+	if (!p) return false;
+
+	// when not connected yet, it will be done once the socket is opened
+	pthread_mutex_lock(&p->mutex);
+	p->outq.periods = periods ? min(max(periods, OUTQ_MIN_PERIODS), OUTQ_MAX_PERIODS) : 0;
+	p->outq.tune.enabled = periods != 0;
+	_raopcl_set_sndbuf(p);
+	rc = p->rtp_ports.audio.fd == -1 || p->outq.sndbuf > 0;
+	pthread_mutex_unlock(&p->mutex);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raopcl_set_prefill(struct raopcl_s *p, bool enable, u32_t margin_ms)
+{
+	if (!p) return;
+
+	pthread_mutex_lock(&p->mutex);
+	p->prefill.enabled = enable;
+	p->prefill.margin = MS2TS(margin_ms, p->sample_rate);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_send_bulk(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size)
+{
+	// not urgent, let it be spread with other sessions' bursts
+	if (p->tx || p->repairing || p->state != RAOP_STREAMING ||
+		!raop_shaper_queue(p, p->rtp_ports.audio.fd, NULL, packet, size)) {
+		_raopcl_send_audio(p, packet, size);
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raopcl_set_tx(struct raopcl_s *p, struct raoptx_s *tx)
+{
+	if (!p) return;
+
+	pthread_mutex_lock(&p->mutex);
+	p->tx = tx;
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_set_txtime(struct raopcl_s *p, u32_t horizon_ms)
+{
+	if (!p) return false;
+
+	pthread_mutex_lock(&p->mutex);
+
+	// frames can be handed to the kernel up to horizon ahead
+	p->txtime.horizon = MS2TS(horizon_ms, p->sample_rate);
+	_raopcl_set_txtime(p);
+
+	pthread_mutex_unlock(&p->mutex);
+
+	return !horizon_ms || p->txtime.lead;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static ssize_t _raopcl_send_packet(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size)
+{
+#if LINUX
+	if (p->txtime.clock != -1) return _raopcl_send_txtime(p, packet, size);
+#endif
+	return send(p->rtp_ports.audio.fd, (void*) packet, size, 0);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool _raopcl_send_audio(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size)
+{
+	ssize_t n;
 	bool ret = true;
 
 	/*
@@ -631,47 +1850,207 @@ bool _raopcl_send_audio(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size)
 	*/
 	if (p->rtp_ports.audio.fd == -1 || p->state != RAOP_STREAMING) return false;
 
-	addr.sin_family = AF_INET;
-	addr.sin_addr = p->host_addr;
-	addr.sin_port = htons(p->rtp_ports.audio.rport);
+	// packets are still in the backlog and will be re-sent once repaired
+	if (p->repairing) return false;
+
+	// shared engine will send it with others at next tick
+	if (p->tx) {
+		struct sockaddr_in addr;
 
-	FD_ZERO(&wfds);
-	FD_SET(p->rtp_ports.audio.fd, &wfds);
+		addr.sin_family = AF_INET;
+		addr.sin_addr = p->host_addr;
+		addr.sin_port = htons(p->rtp_ports.audio.rport);
+
+		if (raoptx_queue(p->tx, &addr, packet, size)) {
+			raop_shaper_consume(size);
+			p->sane.audio.avail = p->sane.audio.send = 0;
+			return true;
+		}
+
+		LOG_DEBUG("[%p]: transmit engine full", p);
+		p->sane.audio.avail++;
+		return false;
+	}
 
 	/*
-	  The audio socket is non blocking, so we can can wait socket availability
-	  but not too much. Half of the packet size if a good value. There is the
-	  backlog buffer to re-send packets if needed, so nothign is lost
+	  The audio socket is non blocking and connected, so just try to send. Only
+	  when it's full, we can wait socket availability but not too much. Half of
+	  the packet size if a good value. There is the backlog buffer to re-send
+	  packets if needed, so nothing is lost
 	*/
-	timeout.tv_sec = 0;
-	timeout.tv_usec = (p->chunk_len * 1000000L) / (p->sample_rate * 2);
+	n = _raopcl_send_packet(p, packet, size);
 
-	if (select(p->rtp_ports.audio.fd + 1, NULL, &wfds, NULL, &timeout) == -1) {
-		LOG_ERROR("[%p]: audio socket closed", p);
-		p->sane.audio.select++;
+	// what is queued in the kernel tells congestion before anything is lost
+	if (++p->outq.count % OUTQ_CHECK == 0 || n == -1) {
+		_raopcl_sample_outq(p, n == -1 && last_error() == ERROR_WOULDBLOCK);
 	}
-	else p->sane.audio.select = 0;
 
-	if (FD_ISSET(p->rtp_ports.audio.fd, &wfds)) {
-		n = sendto(p->rtp_ports.audio.fd, (void*) packet, + size, 0, (void*) &addr, sizeof(addr));
-		if (n != size) {
-			LOG_DEBUG("[%p]: error sending audio packet", p);
-			ret = false;
-			p->sane.audio.send++;
+	if (n == -1 && last_error() == ERROR_WOULDBLOCK) {
+		struct pollfd pfds = { p->rtp_ports.audio.fd, POLLOUT, 0 };
+		int rc = poll(&pfds, 1, (p->chunk_len * 1000L) / (p->sample_rate * 2));
+
+		if (rc == -1) {
+			LOG_ERROR("[%p]: audio socket closed", p);
+			p->sane.audio.select++;
 		}
-		else p->sane.audio.send = 0;
-		p->sane.audio.avail = 0;
+		else p->sane.audio.select = 0;
+
+		if (rc <= 0 || !(pfds.revents & POLLOUT)) {
+			LOG_DEBUG("[%p]: audio socket unavailable", p);
+			p->sane.audio.avail++;
+			return false;
+		}
+
+		n = _raopcl_send_packet(p, packet, size);
 	}
-	else {
-		LOG_DEBUG("[%p]: audio socket unavailable", p);
+	else p->sane.audio.select = 0;
+
+	if (n != size) {
+		LOG_DEBUG("[%p]: error sending audio packet", p);
 		ret = false;
-		p->sane.audio.avail++;
+		p->sane.audio.send++;
 	}
+	else {
+		raop_shaper_consume(size);
+		p->sane.audio.send = 0;
+	}
+	p->sane.audio.avail = 0;
 
 	return ret;
 }
 
 
+/*----------------------------------------------------------------------------*/
+static void *_raopcl_resend_thread(void *args)
+{
+	struct raopcl_s *p = (struct raopcl_s*) args;
+	u16_t i, seq, count, skipped = 0, sent = 0;
+
+	pthread_mutex_lock(&p->mutex);
+	seq = p->resend.seq;
+	count = p->resend.count;
+	pthread_mutex_unlock(&p->mutex);
+
+	/*
+	 Packets are copied one at a time under the mutex and sent outside of it,
+	 so the audio thread is never held for more than a memcpy and a non-blocking
+	 send (which needs the mutex for launch-time). A full socket is waited for
+	 here and not in the caller's pacing loop. Packets are in timestamp order so
+	 the first ones are the closest to their deadline: the ones that can't make
+	 it anymore are skipped to not delay those which still can
+	*/
+	for (i = 0; i < count; i++) {
+		u16_t index = (u16_t) (seq + i) % MAX_BACKLOG;
+		u32_t now_ts = NTP2TS(get_ntp(NULL), p->sample_rate);
+		rtp_audio_pkt_t *packet;
+		int size;
+		ssize_t n;
+
+		pthread_mutex_lock(&p->mutex);
+
+		if (!p->resend.running || p->state != RAOP_STREAMING || p->repairing || p->rtp_ports.audio.fd == -1) {
+			pthread_mutex_unlock(&p->mutex);
+			break;
+		}
+
+		if (p->backlog[index].seq_number != (u16_t) (seq + i) || !p->backlog[index].buffer) {
+			pthread_mutex_unlock(&p->mutex);
+			continue;
+		}
+
+		// played before it can arrive, the player will do without it
+		if ((s32_t) (p->backlog[index].timestamp + raopcl_latency(p) - now_ts) < p->chunk_len) {
+			pthread_mutex_unlock(&p->mutex);
+			skipped++;
+			continue;
+		}
+
+		if ((packet = malloc(p->backlog[index].size)) == NULL) {
+			pthread_mutex_unlock(&p->mutex);
+			continue;
+		}
+
+		size = p->backlog[index].size;
+		memcpy(packet, p->backlog[index].buffer + sizeof(rtp_header_t), size);
+
+		pthread_mutex_unlock(&p->mutex);
+
+		if (p->tx) {
+			struct sockaddr_in addr;
+
+			addr.sin_family = AF_INET;
+			addr.sin_addr = p->host_addr;
+			addr.sin_port = htons(p->rtp_ports.audio.rport);
+			if (raoptx_queue(p->tx, &addr, packet, size)) sent++;
+		} else if (raop_shaper_queue(p, p->rtp_ports.audio.fd, NULL, packet, size)) {
+			sent++;
+		} else {
+			pthread_mutex_lock(&p->mutex);
+			n = _raopcl_send_packet(p, packet, size);
+			pthread_mutex_unlock(&p->mutex);
+
+			if (n == -1 && last_error() == ERROR_WOULDBLOCK) {
+				struct pollfd pfds = { p->rtp_ports.audio.fd, POLLOUT, 0 };
+				if (poll(&pfds, 1, 50) > 0) {
+					pthread_mutex_lock(&p->mutex);
+					n = _raopcl_send_packet(p, packet, size);
+					pthread_mutex_unlock(&p->mutex);
+				}
+			}
+
+			if (n == size) {
+				raop_shaper_consume(size);
+				sent++;
+			}
+		}
+
+		free(packet);
+	}
+
+	// window is not needed anymore, its packets can be recycled
+	pthread_mutex_lock(&p->mutex);
+	p->resend.running = false;
+	pthread_mutex_unlock(&p->mutex);
+
+	LOG_INFO("[%p]: re-sent %u/%u packets from sn:%u (expired:%u)", p, sent, count, seq, skipped);
+
+	return NULL;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_resend_stop(struct raopcl_s *p)
+{
+	bool joinable;
+
+	// claim the thread under the lock so that only one caller joins it
+	pthread_mutex_lock(&p->mutex);
+	p->resend.running = false;
+	joinable = p->resend.joinable;
+	p->resend.joinable = false;
+	pthread_mutex_unlock(&p->mutex);
+
+	if (joinable) pthread_join(p->resend.thread, NULL);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_resend(struct raopcl_s *p)
+{
+	// a previous one would have to be stale by now
+	_raopcl_resend_stop(p);
+
+	// the thread only starts working once we release the lock
+	pthread_mutex_lock(&p->mutex);
+	if (p->resend.count) {
+		p->resend.running = true;
+		p->resend.joinable = !pthread_create(&p->resend.thread, NULL, _raopcl_resend_thread, (void*) p);
+		p->resend.running = p->resend.joinable;
+	}
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
 /*----------------------------------------------------------------------------*/
 struct raopcl_s *raopcl_create(struct in_addr local, char *DACP_id, char *active_remote,
 							   raop_codec_t codec, int chunk_len, int latency_frames,
@@ -681,11 +2060,15 @@ struct raopcl_s *raopcl_create(struct in_addr local, char *DACP_id, char *active
 {
 	raopcl_data_t *raopcld;
 
-	if (chunk_len > MAX_SAMPLES_PER_CHUNK) {
-		LOG_ERROR("Chunk length must below %d", MAX_SAMPLES_PER_CHUNK);
+	if (chunk_len > RAOP_MAX_CHUNK_LEN || chunk_len <= 0) {
+		LOG_ERROR("Chunk length must below %d", RAOP_MAX_CHUNK_LEN);
 		return NULL;
 	}
 
+	if (chunk_len > MAX_SAMPLES_PER_CHUNK) {
+		LOG_WARN("Chunk length %d above %d, not all players support that", chunk_len, MAX_SAMPLES_PER_CHUNK);
+	}
+
 	// seed random generator
 	raopcld = malloc(sizeof(raopcl_data_t));
 	RAND_seed(raopcld, sizeof(raopcl_data_t));
@@ -702,12 +2085,16 @@ struct raopcl_s *raopcl_create(struct in_addr local, char *DACP_id, char *active
 	if (secret) strncpy(raopcld->secret, secret, SECRET_SIZE);
 	if (et) strncpy(raopcld->et, et, 16);
 	raopcld->latency_frames = max(latency_frames, RAOP_LATENCY_MIN);
+	raopcld->tuning.floor = RAOP_LATENCY_MIN;
 	raopcld->chunk_len = chunk_len;
 	strcpy(raopcld->DACP_id, DACP_id ? DACP_id : "");
 	strcpy(raopcld->active_remote, active_remote ? active_remote : "");
 	raopcld->local_addr = local;
 	raopcld->rtp_ports.ctrl.fd = raopcld->rtp_ports.time.fd = raopcld->rtp_ports.audio.fd = -1;
+	raopcld->txtime.clock = -1;
 	raopcld->seq_number = _random(0xffff);
+	raopcld->dither = _random(0xffff) | 1;
+	raopcld->governor.level = RAOP_COMPRESS_FAST;
 
 	if (md && strchr(md, '0')) raopcld->md_caps |= MD_TEXT;
 	if (md && strchr(md, '1')) raopcld->md_caps |= MD_ARTWORK;
@@ -728,6 +2115,7 @@ struct raopcl_s *raopcl_create(struct in_addr local, char *DACP_id, char *active
 	LOG_INFO("[%p]: using %s coding", raopcld, raopcld->alac_codec ? "ALAC" : "PCM");
 
 	pthread_mutex_init(&raopcld->mutex, NULL);
+	pthread_mutex_init(&raopcld->encoder, NULL);
 
 	RAND_bytes(raopcld->iv, sizeof(raopcld->iv));
 	VALGRIND_MAKE_MEM_DEFINED(raopcld->iv, sizeof(raopcld->iv));
@@ -745,12 +2133,19 @@ struct raopcl_s *raopcl_create(struct in_addr local, char *DACP_id, char *active
 /*----------------------------------------------------------------------------*/
 static void _raopcl_terminate_rtp(struct raopcl_s *p)
 {
-	// Terminate RTP threads and close sockets
-	p->ctrl_running = false;
-	pthread_join(p->ctrl_thread, NULL);
+	// Terminate RTP threads (if any, they might have been already) and close sockets
+	_raopcl_resend_stop(p);
+	raop_shaper_purge(p);
+
+	if (p->ctrl_running) {
+		p->ctrl_running = false;
+		pthread_join(p->ctrl_thread, NULL);
+	}
 
-	p->time_running = false;
-	pthread_join(p->time_thread, NULL);
+	if (p->time_running) {
+		p->time_running = false;
+		pthread_join(p->time_thread, NULL);
+	}
 
 	if (p->rtp_ports.ctrl.fd != -1) closesocket(p->rtp_ports.ctrl.fd);
 	if (p->rtp_ports.time.fd != -1) closesocket(p->rtp_ports.time.fd);
@@ -953,15 +2348,57 @@ static bool raopcl_analyse_setup(struct raopcl_s *p, key_data_t *setup_kd)
 		LOG_ERROR("[%p]: missing a RTP port in response", p);
 		rc = false;
 	} else if (!p->rtp_ports.time.rport) {
-		LOG_INFO("[%p]: missing timing port, will get it later", p);
+		if (p->cache.time_late && raop_cache_fresh(p->cache.time_at, CACHE_TTL_TIMING)) {
+			LOG_DEBUG("[%p]: missing timing port, as usual for this player", p);
+		} else {
+			LOG_INFO("[%p]: missing timing port, will get it later", p);
+		}
 	}
 
+	p->cache.time_late = !p->rtp_ports.time.rport;
+	p->cache.time_at = time(NULL);
+
 	return rc;
 }
 
 
 /*----------------------------------------------------------------------------*/
 bool raopcl_connect(struct raopcl_s *p, struct in_addr host, u16_t destport, bool set_volume)
+{
+	if (!p) return false;
+
+	if (p->state >= RAOP_FLUSHING) return true;
+
+	if (host.s_addr != INADDR_ANY) p->host_addr.s_addr = host.s_addr;
+	if (destport != 0) p->rtsp_port = destport;
+
+	RAND_bytes((u8_t*) &p->ssrc, sizeof(p->ssrc));
+	VALGRIND_MAKE_MEM_DEFINED(&p->ssrc, sizeof(p->ssrc));
+
+	p->encrypt = (p->crypto != RAOP_CLEAR);
+	p->retransmit = 0;
+
+	// silence depends on encryption
+	pthread_mutex_lock(&p->mutex);
+	pthread_mutex_lock(&p->encoder);
+	_raopcl_silence_clear(p);
+	pthread_mutex_unlock(&p->encoder);
+	pthread_mutex_unlock(&p->mutex);
+
+	return _raopcl_connect(p, set_volume, false);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_cache_update(struct raopcl_s *p)
+{
+	// without a device identity, nothing is remembered
+	if (*p->cache.id) raop_cache_update(&p->cache);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _raopcl_connect(struct raopcl_s *p, bool set_volume, bool repair)
 {
 	struct {
 		u32_t sid;
@@ -973,22 +2410,12 @@ bool raopcl_connect(struct raopcl_s *p, struct in_addr host, u16_t destport, boo
 	char sdp[1024];
 	key_data_t kd[MAX_KD];
 	char *buf;
-
-	if (!p) return false;
-
-	if (p->state >= RAOP_FLUSHING) return true;
+	u16_t seq_number;
+	u64_t timestamp;
 
 	kd[0].key = NULL;
 
-	if (host.s_addr != INADDR_ANY) p->host_addr.s_addr = host.s_addr;
-	if (destport != 0) p->rtsp_port = destport;
-
-	RAND_bytes((u8_t*) &p->ssrc, sizeof(p->ssrc));
-	VALGRIND_MAKE_MEM_DEFINED(&p->ssrc, sizeof(p->ssrc));
-
-	p->encrypt = (p->crypto != RAOP_CLEAR);
 	memset(&p->sane, 0, sizeof(p->sane));
-	p->retransmit = 0;
 
 	RAND_bytes((u8_t*) &seed, sizeof(seed));
 	VALGRIND_MAKE_MEM_DEFINED(&seed, sizeof(seed));
@@ -1000,19 +2427,71 @@ bool raopcl_connect(struct raopcl_s *p, struct in_addr host, u16_t destport, boo
 	if (*p->DACP_id) rtspcl_add_exthds(p->rtspcl,"DACP-ID", p->DACP_id);
 	if (*p->active_remote) rtspcl_add_exthds(p->rtspcl,"Active-Remote", p->active_remote);
 
+	/*
+	 What we learnt from previous connections with that player lets us skip
+	 the steps we know are useless and get the right latency before RECORD,
+	 so that raopcl_latency() is correct as soon as we are connected. A cache
+	 miss leaves everything as if there was no cache.
+	*/
+	if (!*p->device_id || !raop_cache_lookup(p->device_id, &p->cache)) {
+		memset(&p->cache, 0, sizeof(p->cache));
+		strcpy(p->cache.id, p->device_id);
+	} else if (!repair && raop_cache_fresh(p->cache.latency_at, CACHE_TTL_LATENCY)) {
+		// latency never changes while streaming, repair happens in the middle of it
+		p->latency_frames = max(p->cache.latency, p->latency_frames);
+		LOG_INFO("[%p]: using cached latency %u", p, p->cache.latency);
+	}
+
 	// RTSP connect
-	if (!rtspcl_connect(p->rtspcl, p->local_addr, host, destport, sid)) goto erexit;
+	if (!rtspcl_connect(p->rtspcl, p->local_addr, p->host_addr, p->rtsp_port, sid)) goto erexit;
 
 	LOG_INFO("[%p]: local interface %s", p, rtspcl_local_ip(p->rtspcl));
 
-	// RTSP pairing verify for AppleTV
-	if (*p->secret && !rtspcl_pair_verify(p->rtspcl, p->secret)) goto erexit;
+	// RTSP pairing verify for AppleTV, a known refusal is only a hint
+	if (*p->secret) {
+		u32_t hash = raop_cache_hash(p->secret);
+		int status;
+
+		if (!p->cache.verify_ok && p->cache.verify_hash == hash &&
+			raop_cache_fresh(p->cache.verify_at, CACHE_TTL_VERIFY)) {
+			LOG_WARN("[%p]: AppleTV refused this secret recently (might need to pair again)", p);
+		}
+
+		if (!rtspcl_pair_verify(p->rtspcl, p->secret)) {
+			/*
+			 Only an explicit refusal of the credentials is worth remembering,
+			 not a busy or failing player (5xx) nor a network error (0)
+			*/
+			status = rtspcl_status(p->rtspcl);
+			if (status == 403 || status == 470) {
+				p->cache.verify_ok = false;
+				p->cache.verify_hash = hash;
+				p->cache.verify_at = time(NULL);
+				_raopcl_cache_update(p);
+			}
+			goto erexit;
+		}
+
+		p->cache.verify_ok = true;
+		p->cache.verify_hash = hash;
+		p->cache.verify_at = time(NULL);
+	}
+
+	// Send pubkey for MFi devices, unless it has been refused recently
+	if (strchr(p->et, '4')) {
+		if (p->cache.auth_ok || !raop_cache_fresh(p->cache.auth_at, CACHE_TTL_AUTH)) {
+			bool auth_ok = rtspcl_auth_setup(p->rtspcl);
 
-	// Send pubkey for MFi devices
-	if (strchr(p->et, '4')) rtspcl_auth_setup(p->rtspcl);
+			if (auth_ok || rtspcl_status(p->rtspcl)) {
+				p->cache.auth_ok = auth_ok;
+				p->cache.auth_at = time(NULL);
+			}
+		}
+		else LOG_INFO("[%p]: skipping auth-setup, refused by player", p);
+	}
 
 	// build sdp parameter
-	buf = strdup(inet_ntoa(host));
+	buf = strdup(inet_ntoa(p->host_addr));
 	sprintf(sdp,
 			"v=0\r\n"
 			"o=iTunes %s 0 IN IP4 %s\r\n"
@@ -1025,10 +2504,13 @@ bool raopcl_connect(struct raopcl_s *p, struct in_addr host, u16_t destport, boo
 	if (!raopcl_set_sdp(p, sdp)) goto erexit;
 
 	// AppleTV expects now the timing port ot be opened BEFORE the setup message
-	p->rtp_ports.time.lport = p->rtp_ports.time.rport = 0;
-	if ((p->rtp_ports.time.fd = open_udp_socket(p->local_addr, &p->rtp_ports.time.lport, true)) == -1) goto erexit;
-	p->time_running = true;
-	pthread_create(&p->time_thread, NULL, _rtp_timing_thread, (void*) p);
+	p->rtp_ports.time.rport = 0;
+	if (p->rtp_ports.time.fd == -1) {
+		p->rtp_ports.time.lport = 0;
+		if ((p->rtp_ports.time.fd = open_udp_socket(p->local_addr, &p->rtp_ports.time.lport, true)) == -1) goto erexit;
+		p->time_running = true;
+		pthread_create(&p->time_thread, NULL, _rtp_timing_thread, (void*) p);
+	}
 
 	// RTSP ANNOUNCE
 	if (p->auth && p->crypto) {
@@ -1041,30 +2523,57 @@ bool raopcl_connect(struct raopcl_s *p, struct in_addr host, u16_t destport, boo
 	else if (!rtspcl_announce_sdp(p->rtspcl, sdp))goto erexit;
 
 	// open RTP sockets, need local ports here before sending SETUP
-	p->rtp_ports.ctrl.lport = p->rtp_ports.audio.lport = 0;
-	if ((p->rtp_ports.ctrl.fd = open_udp_socket(p->local_addr, &p->rtp_ports.ctrl.lport, true)) == -1) goto erexit;
-	if ((p->rtp_ports.audio.fd = open_udp_socket(p->local_addr, &p->rtp_ports.audio.lport, false)) == -1) goto erexit;
+	if (p->rtp_ports.ctrl.fd == -1) {
+		p->rtp_ports.ctrl.lport = 0;
+		if ((p->rtp_ports.ctrl.fd = open_udp_socket(p->local_addr, &p->rtp_ports.ctrl.lport, true)) == -1) goto erexit;
+	}
+	if (p->rtp_ports.audio.fd == -1) {
+		p->rtp_ports.audio.lport = 0;
+		if ((p->rtp_ports.audio.fd = open_udp_socket(p->local_addr, &p->rtp_ports.audio.lport, false)) == -1) goto erexit;
+		_raopcl_set_txtime(p);
+		_raopcl_set_sndbuf(p);
+	}
 
 	// RTSP SETUP : get all RTP destination ports
 	if (!rtspcl_setup(p->rtspcl, &p->rtp_ports, kd)) goto erexit;
 	if (!raopcl_analyse_setup(p, kd)) goto erexit;
 	free_kd(kd);
 
+	if (!_raopcl_connect_audio(p)) goto erexit;
+
 	LOG_DEBUG( "[%p]:opened audio socket   l:%5d r:%d", p, p->rtp_ports.audio.lport, p->rtp_ports.audio.rport );
 	LOG_DEBUG( "[%p]:opened timing socket  l:%5d r:%d", p, p->rtp_ports.time.lport, p->rtp_ports.time.rport );
 	LOG_DEBUG( "[%p]:opened control socket l:%5d r:%d", p, p->rtp_ports.ctrl.lport, p->rtp_ports.ctrl.rport );
 
-	if (!rtspcl_record(p->rtspcl, p->seq_number + 1, NTP2TS(get_ntp(NULL), p->sample_rate), kd)) goto erexit;
+	// when repairing, record from the oldest packet that can still be played
+	if (repair) {
+		pthread_mutex_lock(&p->mutex);
+		seq_number = _raopcl_window(p, &timestamp);
+		pthread_mutex_unlock(&p->mutex);
+	} else {
+		seq_number = p->seq_number + 1;
+		timestamp = NTP2TS(get_ntp(NULL), p->sample_rate);
+	}
+
+	if (!rtspcl_record(p->rtspcl, seq_number, timestamp, kd)) goto erexit;
 
 	if (kd_lookup(kd, "Audio-Latency")) {
 		int latency = atoi(kd_lookup(kd, "Audio-Latency"));
 
-		p->latency_frames = max((u32_t) latency, p->latency_frames);
+		// latency never changes while streaming
+		if (!repair) p->latency_frames = max((u32_t) latency, p->latency_frames);
+		p->tuning.floor = max((u32_t) latency, RAOP_LATENCY_MIN);
+		p->cache.latency = latency;
+		p->cache.latency_at = time(NULL);
 	}
 	free_kd(kd);
 
-	p->ctrl_running = true;
-	pthread_create(&p->ctrl_thread, NULL, _rtp_control_thread, (void*) p);
+	_raopcl_cache_update(p);
+
+	if (!p->ctrl_running) {
+		p->ctrl_running = true;
+		pthread_create(&p->ctrl_thread, NULL, _rtp_control_thread, (void*) p);
+	}
 
 	pthread_mutex_lock(&p->mutex);
 	// as connect might take time, state might already have been set
@@ -1079,12 +2588,74 @@ bool raopcl_connect(struct raopcl_s *p, struct in_addr host, u16_t destport, boo
  erexit:
 	if (sac) free(sac);
 	free_kd(kd);
-	_raopcl_disconnect(p, true);
+	// a failed repair is left to caller who will fall back to a full one
+	if (!repair) _raopcl_disconnect(p, true);
 
 	return false;
 }
 
 
+/*----------------------------------------------------------------------------*/
+bool raopcl_set_governor(struct raopcl_s *p, bool enable)
+{
+	if (!p || !p->alac_codec) return false;
+
+	pthread_mutex_lock(&p->mutex);
+	pthread_mutex_lock(&p->encoder);
+	p->governor.enabled = enable;
+	p->governor.level = RAOP_COMPRESS_FAST;
+	p->codec = RAOP_ALAC;
+	alac_set_fast_mode(p->alac_codec, true);
+	_raopcl_silence_clear(p);
+	pthread_mutex_unlock(&p->encoder);
+	pthread_mutex_unlock(&p->mutex);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_govern(struct raopcl_s *p)
+{
+	u32_t period = (u64_t) p->chunk_len * 1000000 / p->sample_rate;
+	u32_t avg = p->governor.count ? p->governor.total / p->governor.count : 0;
+	raop_compression_t level = p->governor.level;
+	double load = 0;
+
+#if LINUX || OSX || FREEBSD
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (getloadavg(&load, 1) == 1 && cpus > 0) load /= cpus;
+#endif
+
+	// called when flushed, mutex & encoder locked
+	if (!p->governor.count) return;
+
+	/*
+	 Deadlines come first: step down when encoding takes a sizeable part of
+	 the packet period, when a packet could not make it or when the host is
+	 saturated. Only step up when all is quiet, it will be undone at next
+	 flush if too costly
+	*/
+	if (avg > period / 4 || p->governor.max > period / 2 || p->governor.late || load > 1.0) {
+		if (level > RAOP_COMPRESS_RAW) level--;
+	} else if (avg < period / 20 && p->governor.max < period / 4 && load < 0.5) {
+		if (level < RAOP_COMPRESS_SLOW) level++;
+	}
+
+	LOG_INFO("[%p]: governor avg:%uus max:%uus period:%uus late:%u load:%.2f => %d (current %d)",
+			 p, avg, p->governor.max, period, p->governor.late, load, level, p->governor.level);
+
+	if (level != p->governor.level) {
+		p->governor.level = level;
+		p->governor.changes++;
+		// raw is still ALAC (verbatim), so the SDP is unchanged
+		p->codec = level == RAOP_COMPRESS_RAW ? RAOP_ALAC_RAW : RAOP_ALAC;
+		alac_set_fast_mode(p->alac_codec, level != RAOP_COMPRESS_SLOW);
+		_raopcl_silence_clear(p);
+	}
+}
+
+
 /*----------------------------------------------------------------------------*/
 bool raopcl_flush(struct raopcl_s *p)
 {
@@ -1094,6 +2665,10 @@ bool raopcl_flush(struct raopcl_s *p)
 
 	if (!p || p->state != RAOP_STREAMING) return false;
 
+	// what is waiting to be re-sent is now useless
+	_raopcl_resend_stop(p);
+	raop_shaper_purge(p);
+
 	pthread_mutex_lock(&p->mutex);
 	p->state = RAOP_FLUSHING;
 	p->retransmit = 0;
@@ -1108,6 +2683,13 @@ bool raopcl_flush(struct raopcl_s *p)
 
 	pthread_mutex_lock(&p->mutex);
 	p->state = RAOP_FLUSHED;
+	// nothing is streaming, the only moment when latency can be changed
+	pthread_mutex_lock(&p->encoder);
+	if (p->governor.enabled) _raopcl_govern(p);
+	p->governor.count = p->governor.total = p->governor.max = 0;
+	pthread_mutex_unlock(&p->encoder);
+	p->governor.late = 0;
+	if (p->tuning.mode != RAOP_TUNING_OFF) _raopcl_tune_latency(p);
 	pthread_mutex_unlock(&p->mutex);
 
 	return rc;
@@ -1167,6 +2749,112 @@ bool raopcl_repair(struct raopcl_s *p, bool set_volume)
 }
 
 
+/*----------------------------------------------------------------------------*/
+static u16_t _raopcl_window(struct raopcl_s *p, u64_t *timestamp)
+{
+	u64_t now_ts = NTP2TS(get_ntp(NULL), p->sample_rate);
+	u16_t n, i;
+
+	// oldest packet in backlog that the player has not played yet
+	for (n = p->seq_number, i = 0; i < MAX_BACKLOG; i++, n--) {
+		u16_t index = n % MAX_BACKLOG;
+
+		if (!p->backlog[index].buffer || p->backlog[index].seq_number != n ||
+			p->backlog[index].timestamp + raopcl_latency(p) <= now_ts) break;
+	}
+
+	n++;
+	*timestamp = n == (u16_t) (p->seq_number + 1) ? p->head_ts : p->backlog[n % MAX_BACKLOG].timestamp;
+
+	return n;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_resend_window(struct raopcl_s *p)
+{
+	u64_t timestamp;
+
+	pthread_mutex_lock(&p->mutex);
+
+	_raopcl_send_sync(p, true);
+
+	// same seq and ts than before, player's buffer is just refilled
+	p->resend.seq = _raopcl_window(p, &timestamp);
+	p->resend.count = p->seq_number - p->resend.seq + 1;
+
+	LOG_INFO("[%p]: re-sending %u packets from ts:%Lu", p, p->resend.count, timestamp);
+
+	pthread_mutex_unlock(&p->mutex);
+
+	_raopcl_resend(p);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_repair_fast(struct raopcl_s *p, bool set_volume)
+{
+	bool udp, rtsp, rc = true;
+
+	if (!p) return false;
+
+	// nothing to preserve, so no reason to be smart
+	if (p->state < RAOP_FLUSHED) return raopcl_repair(p, set_volume);
+
+	rtsp = !rtspcl_is_connected(p->rtspcl) || !rtspcl_options(p->rtspcl, NULL);
+	udp = p->rtp_ports.audio.fd == -1 || p->rtp_ports.ctrl.fd == -1 || p->rtp_ports.time.fd == -1 ||
+		  p->sane.audio.select || p->sane.audio.send >= 500 || p->sane.ctrl > 2 || p->sane.time > 2;
+
+	LOG_INFO("[%p]: repairing in place (rtsp:%d udp:%d)", p, rtsp, udp);
+
+	pthread_mutex_lock(&p->mutex);
+	p->repairing = true;
+	pthread_mutex_unlock(&p->mutex);
+
+	// re-open UDP sockets on the same local ports, the player won't notice
+	if (udp) {
+		u16_t lport[3] = { p->rtp_ports.time.lport, p->rtp_ports.ctrl.lport, p->rtp_ports.audio.lport };
+
+		_raopcl_terminate_rtp(p);
+
+		if ((p->rtp_ports.time.fd = open_udp_socket(p->local_addr, &lport[0], true)) == -1 ||
+			(p->rtp_ports.ctrl.fd = open_udp_socket(p->local_addr, &lport[1], true)) == -1 ||
+			(p->rtp_ports.audio.fd = open_udp_socket(p->local_addr, &lport[2], false)) == -1 ||
+			!_raopcl_connect_audio(p)) {
+			LOG_WARN("[%p]: cannot re-open RTP ports", p);
+			rc = false;
+		} else {
+			_raopcl_set_txtime(p);
+			_raopcl_set_sndbuf(p);
+			p->time_running = p->ctrl_running = true;
+			pthread_create(&p->time_thread, NULL, _rtp_timing_thread, (void*) p);
+			pthread_create(&p->ctrl_thread, NULL, _rtp_control_thread, (void*) p);
+			memset(&p->sane, 0, sizeof(p->sane));
+		}
+	}
+
+	// new RTSP session re-using RTP ports, key and sequence
+	if (rc && rtsp) {
+		rtspcl_disconnect(p->rtspcl);
+		rtspcl_remove_all_exthds(p->rtspcl);
+		rc = _raopcl_connect(p, set_volume, true);
+	}
+
+	pthread_mutex_lock(&p->mutex);
+	p->repairing = false;
+	pthread_mutex_unlock(&p->mutex);
+
+	if (!rc) {
+		LOG_WARN("[%p]: repair in place failed, full repair", p);
+		return raopcl_repair(p, set_volume);
+	}
+
+	if (p->state == RAOP_STREAMING) _raopcl_resend_window(p);
+
+	return true;
+}
+
+
 /*----------------------------------------------------------------------------*/
 bool raopcl_destroy(struct raopcl_s *p)
 {
@@ -1175,9 +2863,11 @@ bool raopcl_destroy(struct raopcl_s *p)
 
 	if (!p) return false;
 
+	_raopcl_pipeline_stop(p);
 	rc = raopcl_disconnect(p);
 	rc &= rtspcl_destroy(p->rtspcl);
 	pthread_mutex_destroy(&p->mutex);
+	pthread_mutex_destroy(&p->encoder);
 
 	for (i = 0; i < MAX_BACKLOG; i++) {
 		if (p->backlog[i].buffer) {
@@ -1186,6 +2876,9 @@ bool raopcl_destroy(struct raopcl_s *p)
 	}
 
 	if (p->alac_codec) alac_delete_encoder(p->alac_codec);
+	if (p->direct.buffer) free(p->direct.buffer);
+	if (p->staging) free(p->staging);
+	_raopcl_silence_clear(p);
 
 	free(p);
 
@@ -1264,25 +2957,23 @@ void *_rtp_timing_thread(void *args)
 
 	addr.sin_family = AF_INET;
 	addr.sin_addr = raopcld->host_addr;
-	addr.sin_port = htons(raopcld->rtp_ports.time.rport);
 
 	while (raopcld->time_running)
 	{
 		rtp_time_pkt_t req;
-		struct timeval timeout = { 1, 0 };
-		fd_set rfds;
+		struct pollfd pfds = { raopcld->rtp_ports.time.fd, POLLIN, 0 };
 		int n;
 
-		FD_ZERO(&rfds);
-		FD_SET(raopcld->rtp_ports.time.fd, &rfds);
-
-		if ((n = select(raopcld->rtp_ports.time.fd + 1, &rfds, NULL, NULL, &timeout)) == -1) {
+		if ((n = poll(&pfds, 1, 1000)) == -1) {
 			LOG_ERROR("[%p]: raopcl_time_connect: socket closed on the other end", raopcld);
 			usleep(100000);
 			continue;
 		}
 
-		if (!FD_ISSET(raopcld->rtp_ports.time.fd, &rfds)) continue;
+		if (!(pfds.revents & POLLIN)) continue;
+
+		// remote port might change when RTSP session is repaired
+		addr.sin_port = htons(raopcld->rtp_ports.time.rport);
 
 		if (addr.sin_port) {
 			n = recv(raopcld->rtp_ports.time.fd, (void*) &req, sizeof(req), 0);
@@ -1292,11 +2983,55 @@ void *_rtp_timing_thread(void *args)
 			int len = sizeof(client);
 			n = recvfrom(raopcld->rtp_ports.time.fd, (void*) &req, sizeof(req), 0, (struct sockaddr *)&client, (socklen_t *)&len);
 			addr.sin_port = client.sin_port;
+			raopcld->rtp_ports.time.rport = ntohs(client.sin_port);
 			LOG_DEBUG("[%p]: NTP remote port: %d", raopcld, ntohs(addr.sin_port));
 		}
 
 		if( n > 0) 	{
 			rtp_time_pkt_t rsp;
+			u64_t now_ntp = get_ntp(NULL);
+			u64_t ref = ((u64_t) ntohl(req.ref_time.seconds) << 32) | ntohl(req.ref_time.fraction);
+			u64_t recv = ((u64_t) ntohl(req.recv_time.seconds) << 32) | ntohl(req.recv_time.fraction);
+			u64_t send = ((u64_t) ntohl(req.send_time.seconds) << 32) | ntohl(req.send_time.fraction);
+			u32_t now = NTP2MS(now_ntp), interval;
+
+			// tuning is read and reset by others under the mutex
+			pthread_mutex_lock(&raopcld->mutex);
+
+			/*
+			 Players that answer like NTP put our previous reply's send time in
+			 the reference, and their own receive/send times around it. The round
+			 trip is then the time elapsed here minus the time held there, and
+			 jitter is how much it varies (EWMA 1/8 and 1/4)
+			*/
+			if (ref && ref == raopcld->tuning.last_reply && now_ntp > ref && send >= recv &&
+				send - recv < now_ntp - ref) {
+				u32_t rtt = NTP2TS((now_ntp - ref) - (send - recv), raopcld->sample_rate);
+				s32_t delta = rtt - raopcld->tuning.rtt;
+
+				if (raopcld->tuning.rtt) {
+					raopcld->tuning.rtt += delta / 8;
+					raopcld->tuning.jitter += ((s32_t) (delta > 0 ? delta : -delta) - (s32_t) raopcld->tuning.jitter) / 4;
+				} else {
+					raopcld->tuning.rtt = rtt;
+					raopcld->tuning.jitter = rtt / 2;
+				}
+			}
+
+			interval = now - raopcld->tuning.last_request;
+
+			/*
+			 Others leave no round trip to measure, so jitter falls back to how
+			 much the interval between their requests varies (EWMA 1/8)
+			*/
+			if (!raopcld->tuning.rtt && raopcld->tuning.last_request && raopcld->tuning.last_interval) {
+				s32_t delta = interval - raopcld->tuning.last_interval;
+				u32_t jitter = MS2TS(delta > 0 ? delta : -delta, raopcld->sample_rate);
+				raopcld->tuning.jitter += ((s32_t) jitter - (s32_t) raopcld->tuning.jitter) / 8;
+			}
+
+			if (raopcld->tuning.last_request) raopcld->tuning.last_interval = interval;
+			raopcld->tuning.last_request = now;
 
 			rsp.hdr = req.hdr;
 			rsp.hdr.type = 0x53 | 0x80;
@@ -1305,7 +3040,9 @@ void *_rtp_timing_thread(void *args)
 			VALGRIND_MAKE_MEM_DEFINED(&rsp, sizeof(rsp));
 
 			// transform timeval into NTP and set network order
-			get_ntp(&rsp.recv_time);
+			raopcld->tuning.last_reply = get_ntp(&rsp.recv_time);
+
+			pthread_mutex_unlock(&raopcld->mutex);
 
 			rsp.recv_time.seconds = htonl(rsp.recv_time.seconds);
 			rsp.recv_time.fraction = htonl(rsp.recv_time.fraction);
@@ -1343,13 +3080,9 @@ void *_rtp_control_thread(void *args)
 	raopcl_data_t *raopcld = (raopcl_data_t*) args;
 
 	while (raopcld->ctrl_running)	{
-		struct timeval timeout = { 1, 0 };
-		fd_set rfds;
+		struct pollfd pfds = { raopcld->rtp_ports.ctrl.fd, POLLIN, 0 };
 
-		FD_ZERO(&rfds);
-		FD_SET(raopcld->rtp_ports.ctrl.fd, &rfds);
-
-		if (select(raopcld->rtp_ports.ctrl.fd + 1, &rfds, NULL, NULL, &timeout) == -1) {
+		if (poll(&pfds, 1, 1000) == -1) {
 			if (raopcld->ctrl_running) {
 				LOG_ERROR("[%p]: control socket closed", raopcld);
 				raopcld->sane.ctrl++;
@@ -1358,9 +3091,10 @@ void *_rtp_control_thread(void *args)
 			continue;
 		}
 
-		if (FD_ISSET(raopcld->rtp_ports.ctrl.fd, &rfds)) {
+		if (pfds.revents & POLLIN) {
 			rtp_lost_pkt_t lost;
 			int i, n, missed;
+			u64_t now_ts;
 
 			n = recv(raopcld->rtp_ports.ctrl.fd, (void*) &lost, sizeof(lost), 0);
 
@@ -1380,13 +3114,26 @@ void *_rtp_control_thread(void *args)
 
 			pthread_mutex_lock(&raopcld->mutex);
 
+			now_ts = NTP2TS(get_ntp(NULL), raopcld->sample_rate);
+			raopcld->tuning.lost += lost.n;
+
 			for (missed = 0, i = 0; i < lost.n; i++) {
 				u16_t index = (lost.seq_number + i) % MAX_BACKLOG;
 
 				if (raopcld->backlog[index].seq_number == lost.seq_number + i) {
+					u64_t timestamp = raopcld->backlog[index].timestamp;
 					struct sockaddr_in addr;
 					rtp_header_t *hdr = (rtp_header_t*) raopcld->backlog[index].buffer;
 
+					// how long it took to be NACK'd and will it be on time
+					if (now_ts > timestamp) {
+						raopcld->tuning.nack_delay = max(raopcld->tuning.nack_delay, now_ts - timestamp);
+					}
+					if (now_ts + raopcld->chunk_len >= timestamp + raopcl_latency(raopcld)) {
+						raopcld->tuning.late++;
+						raopcld->governor.late++;
+					}
+
 					// packet have been released meanwhile, be extra cautious
 					if (!hdr) {
 						missed++;
@@ -1404,6 +3151,9 @@ void *_rtp_control_thread(void *args)
 
 					raopcld->retransmit++;
 
+					if (raop_shaper_queue(raopcld, raopcld->rtp_ports.ctrl.fd, &addr, hdr,
+										  sizeof(rtp_header_t) + raopcld->backlog[index].size)) continue;
+
 					n = sendto(raopcld->rtp_ports.ctrl.fd, (void*) hdr,
 							   sizeof(rtp_header_t) + raopcld->backlog[index].size,
 							   0, (void*) &addr, sizeof(addr));
@@ -1415,6 +3165,8 @@ void *_rtp_control_thread(void *args)
 				}
 				else {
 					LOG_WARN("[%p]: lost packet out of backlog %u", raopcld, lost.seq_number + i);
+					raopcld->tuning.late++;
+					raopcld->governor.late++;
 				}
 			}
 
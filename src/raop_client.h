@@ -73,7 +73,13 @@
 
 #include "platform.h"
 
+/*
+ 352 frames per packet is what every AirPlay player accepts. Some (mostly wired)
+ accept larger ALAC frames, up to RAOP_MAX_CHUNK_LEN, which means much less
+ packets to send, but these do not fit in one ethernet frame anymore
+*/
 #define MAX_SAMPLES_PER_CHUNK 	352
+#define RAOP_MAX_CHUNK_LEN		4096
 #define RAOP_LATENCY_MIN 		11025
 #define SECRET_SIZE				64
 
@@ -88,6 +94,16 @@
 typedef struct raopcl_t {u32_t dummy;} raopcl_t;
 
 struct raopcl_s;
+struct raoptx_s;
+
+/*
+ Format of samples given to raopcl_send_chunk/raopcl_queue_chunk. S24 is packed
+ on 3 bytes, F32 is in [-1,1]. Wider than 16 bits are converted with a TPDF
+ dither. When planar, channels are consecutive blocks of <frames> samples, so
+ frames must then be <= chunk_len
+*/
+typedef enum raop_input_s { RAOP_INPUT_S16LE = 0, RAOP_INPUT_S16BE,
+							RAOP_INPUT_S24LE, RAOP_INPUT_S32LE, RAOP_INPUT_F32 } raop_input_t;
 
 typedef enum raop_codec_s { RAOP_PCM = 0, RAOP_ALAC_RAW, RAOP_ALAC, RAOP_AAC,
 							RAOP_AAL_ELC } raop_codec_t;
@@ -98,6 +114,26 @@ typedef enum raop_crypto_s { RAOP_CLEAR = 0, RAOP_RSA, RAOP_FAIRPLAY, RAOP_MFISA
 typedef enum raop_states_s { RAOP_DOWN = 0, RAOP_FLUSHING, RAOP_FLUSHED,
 							 RAOP_STREAMING } raop_state_t;
 
+typedef enum raop_tuning_s { RAOP_TUNING_OFF = 0, RAOP_TUNING_RECOMMEND,
+							 RAOP_TUNING_APPLY } raop_tuning_t;
+
+typedef struct {
+	// measured since last flush (latency is in frames)
+	u32_t sent, lost, late;
+	u32_t nack_delay, jitter;
+	u32_t rtt;					// timing round trip, 0 when the player gives none
+	u32_t latency, recommended;
+	u32_t queued, queued_max;	// packets in kernel send queue (max since last call)
+	u32_t backpressure;			// % of send buffer in use
+	u32_t silent;				// packets taken from silence cache (total)
+	u32_t compression;			// raop_compression_t in use
+	u32_t encode_avg, encode_max;	// per packet encoding time (us) since last flush
+	u32_t compression_changes;	// decisions made by the governor (total)
+} raopcl_stats_t;
+
+typedef enum raop_compression_s { RAOP_COMPRESS_RAW = 0, RAOP_COMPRESS_FAST,
+								  RAOP_COMPRESS_SLOW } raop_compression_t;
+
 typedef struct {
 	int channels;
 	int	sample_size;
@@ -145,8 +181,14 @@ struct raopcl_s *raopcl_create(struct in_addr local, char *DACP_id, char *active
 							   int sample_rate, int sample_size, int channels, float volume);
 
 bool	raopcl_destroy(struct raopcl_s *p);
+// path of the receiver capabilities cache shared by all players, NULL to disable
+bool	raopcl_set_cache(char *path);
+// stable identity of the player (mDNS name, pk ...) used as cache key, none = not cached
+bool	raopcl_set_device_id(struct raopcl_s *p, char *id);
 bool	raopcl_connect(struct raopcl_s *p, struct in_addr host, u16_t destport, bool set_volume);
 bool 	raopcl_repair(struct raopcl_s *p, bool set_volume);
+// only re-establish broken RTSP/UDP layer, preserving sequence and backlog
+bool 	raopcl_repair_fast(struct raopcl_s *p, bool set_volume);
 bool 	raopcl_disconnect(struct raopcl_s *p);
 bool    raopcl_flush(struct raopcl_s *p);
 bool 	raopcl_keepalive(struct raopcl_s *p);
@@ -160,8 +202,86 @@ bool 	raopcl_set_artwork(struct raopcl_s *p, char *content_type, int size, char
 
 bool 	raopcl_accept_frames(struct raopcl_s *p);
 bool	raopcl_send_chunk(struct raopcl_s *p, u8_t *sample, int size, u64_t *playtime);
+/*
+ Optional encode-ahead: a worker encodes and encrypts up to depth chunks given
+ by raopcl_queue_chunk (false when full), then after raopcl_accept_frames, use
+ raopcl_send_queued (false when nothing ready) instead of raopcl_send_chunk.
+ Both can't be mixed. raopcl_stop discards what has been queued. When the
+ shared pool is running (see raop_pool.h) it is used instead of a thread and
+ the pipeline must be stopped (depth 0 or raopcl_destroy) before the pool
+*/
+bool	raopcl_set_pipeline(struct raopcl_s *p, int depth);
+bool	raopcl_queue_chunk(struct raopcl_s *p, u8_t *sample, int frames);
+bool	raopcl_send_queued(struct raopcl_s *p, u64_t *playtime);
+int		raopcl_queued_chunks(struct raopcl_s *p);
+/*
+ Encode once for several players (see raop_group.h): payload is encoded with
+ p's codec and is not encrypted, it must be freed by caller. It can be sent to
+ any player with the same encoding, which will encrypt and stamp it
+*/
+bool	raopcl_same_encoding(struct raopcl_s *a, struct raopcl_s *b);
+bool	raopcl_encode_chunk(struct raopcl_s *p, u8_t *sample, int frames, u8_t **payload, int *size);
+bool	raopcl_send_payload(struct raopcl_s *p, u8_t *payload, int size, u64_t *playtime);
+/*
+ ALAC passthrough (ALAC sessions only): frame is one raw ALAC packet of frames
+ samples, as found in an ALAC file, which is sent as-is (only encrypted). Its
+ header must match the session (channels, frames <= chunk_len, partial flag
+ set when less than chunk_len). Use raopcl_check_alac_cookie once with the
+ source's magic cookie to verify bit depth, rate, channels and frame length
+*/
+bool	raopcl_check_alac_cookie(struct raopcl_s *p, u8_t *cookie, int size);
+bool	raopcl_send_encoded(struct raopcl_s *p, u8_t *frame, int size, int frames, u64_t *playtime);
+/*
+ Zero-copy PCM: with RAOP_PCM and interleaved RAOP_INPUT_S16BE, samples already are in
+ network order, so raopcl_get_buffer returns the payload area of the next
+ packet (room for *frames) where caller reads samples directly, then calls
+ raopcl_commit_buffer instead of raopcl_send_chunk. It returns NULL when not
+ possible, use raopcl_send_chunk then. The buffer stays valid until committed
+*/
+bool	raopcl_set_input(struct raopcl_s *p, raop_input_t input, bool planar);
+u8_t*	raopcl_get_buffer(struct raopcl_s *p, int *frames);
+bool	raopcl_commit_buffer(struct raopcl_s *p, int frames, u64_t *playtime);
 
 bool 	raopcl_start_at(struct raopcl_s *p, u64_t start_time);
+// same unit as raopcl_latency, only when not streaming (paused or flushed)
+bool	raopcl_set_latency(struct raopcl_s *p, u32_t latency);
+/*
+ Linux only: packets are accepted up to horizon_ms ahead of their send time and
+ the kernel (fq or etf qdisc) sends them at the right instant (SO_TXTIME). When
+ qdisc is not set or refuses launch times, it falls back to user-space pacing
+*/
+bool	raopcl_set_txtime(struct raopcl_s *p, u32_t horizon_ms);
+/*
+ Size audio socket's send buffer for <periods> packets to start with, then it
+ is regularly doubled when the kernel queue gets close to full and halved when
+ it stays mostly empty (within 8 and 256 packets). 0 = system default, fixed
+*/
+bool	raopcl_set_sndbuf(struct raopcl_s *p, u32_t periods);
+u32_t	raopcl_backpressure(struct raopcl_s *p);
+/*
+ At stream start, accept frames ahead of real-time up to latency minus margin
+ so that player's buffer is filled at once, then keep that lead. Must be called
+ before the stream starts
+*/
+void	raopcl_set_prefill(struct raopcl_s *p, bool enable, u32_t margin_ms);
+// send audio through a shared transmit engine (see raop_tx.h), NULL to stop
+void	raopcl_set_tx(struct raopcl_s *p, struct raoptx_s *tx);
+/*
+ When enabled, loss, retransmit deadlines and timing jitter are used to compute
+ the lowest latency that this player can sustain. The latency is updated only
+ at raopcl_flush (never while streaming) and only with RAOP_TUNING_APPLY. Do not
+ apply it to players that must stay in sync with others
+*/
+void 	raopcl_set_latency_tuning(struct raopcl_s *p, raop_tuning_t mode);
+/*
+ ALAC sessions only: at each raopcl_flush, encoding time versus packet period,
+ late packets and host load (per CPU) decide between slow (smaller), fast and
+ raw (verbatim) ALAC, all decoded alike by the player. The choice starts from
+ fast mode and is reported in stats
+*/
+bool	raopcl_set_governor(struct raopcl_s *p, bool enable);
+// same unit as raopcl_latency (frames + RAOP_LATENCY_MIN), ready for raopcl_set_latency
+u32_t 	raopcl_recommended_latency(struct raopcl_s *p);
 void 	raopcl_pause(struct raopcl_s *p);
 void 	raopcl_stop(struct raopcl_s *p);
 
@@ -174,6 +294,7 @@ raop_state_t raopcl_state(struct raopcl_s *p);
 u32_t 	raopcl_queue_len(struct raopcl_s *p);
 
 u32_t 	raopcl_queued_frames(struct raopcl_s *p);
+bool 	raopcl_get_stats(struct raopcl_s *p, raopcl_stats_t *stats);
 
 bool 	raopcl_is_sane(struct raopcl_s *p);
 bool 	raopcl_is_connected(struct raopcl_s *p);
@@ -0,0 +1,328 @@
+/*****************************************************************************
+ * raop_fcache.c: on-disk cache of encoded audio frames
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "platform.h"
+#if !WIN
+#include <sys/mman.h>
+#endif
+#include "log_util.h"
+#include "aexcl_lib.h"
+#include "alac_wrapper.h"
+#include "raop_fcache.h"
+
+#define FCACHE_MAGIC	"RAOPFC"
+#define FCACHE_VERSION	2		// index is 8 bytes aligned
+
+typedef struct {
+	char magic[8];
+	u32_t version;
+	u32_t chunk_len, sample_rate;
+	u16_t sample_size, channels;
+	u64_t hash, length;
+	u32_t count, unused;
+	u64_t index;			// offset of index
+} fcache_header_t;
+
+typedef struct {
+	u64_t offset;
+	u32_t size, frames;
+} fcache_entry_t;
+
+struct raop_fcache_s {
+	u8_t *base;
+	size_t size;
+	fcache_header_t *header;
+	fcache_entry_t *index;
+};
+
+extern log_level	raop_loglevel;
+static log_level 	*loglevel = &raop_loglevel;
+
+/*----------------------------------------------------------------------------*/
+static u64_t fcache_hash(u64_t hash, u8_t *data, int size)
+{
+	// FNV-1a 64 bits, this is about detecting a changed source, not security
+	while (size--) {
+		hash ^= *data++;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+#define FCACHE_HASH_INIT	14695981039346656037ULL
+
+/*----------------------------------------------------------------------------*/
+bool raop_fcache_build(char *path, int fd, int chunk_len, int sample_rate,
+					   int sample_size, int channels)
+{
+	struct alac_codec_s *codec;
+	fcache_header_t header;
+	fcache_entry_t *index = NULL;
+	int bytes = chunk_len * channels * sample_size / 8, n;
+	u8_t *buf;
+	char *tmp;
+	FILE *out;
+	bool rc = false;
+
+	if ((codec = alac_create_encoder(chunk_len, sample_rate, sample_size, channels)) == NULL) {
+		LOG_ERROR("fcache: cannot create encoder");
+		return false;
+	}
+
+	if ((tmp = _aprintf("%s.tmp", path)) == NULL || (out = fopen(tmp, "wb")) == NULL) {
+		LOG_ERROR("fcache: cannot write %s", tmp ? tmp : path);
+		alac_delete_encoder(codec);
+		if (tmp) free(tmp);
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	strcpy(header.magic, FCACHE_MAGIC);
+	header.version = FCACHE_VERSION;
+	header.chunk_len = chunk_len;
+	header.sample_rate = sample_rate;
+	header.sample_size = sample_size;
+	header.channels = channels;
+	header.hash = FCACHE_HASH_INIT;
+
+	// header is re-written at the end
+	fwrite(&header, sizeof(header), 1, out);
+
+	buf = malloc(bytes);
+
+	while (buf) {
+		fcache_entry_t *entry;
+		int size, len = 0, size_read;
+		u8_t *frame;
+
+		// always complete a chunk, pipes return short reads
+		while (len < bytes && (size_read = read(fd, buf + len, bytes - len)) > 0) len += size_read;
+
+		// all source bytes count, even a trailing partial frame that can't be played
+		header.hash = fcache_hash(header.hash, buf, len);
+		header.length += len;
+
+		if (len < channels * sample_size / 8) {
+			rc = true;
+			break;
+		}
+
+		if ((entry = realloc(index, (header.count + 1) * sizeof(fcache_entry_t))) == NULL) break;
+		index = entry;
+		entry = index + header.count;
+
+		entry->frames = len / (channels * sample_size / 8);
+		if (!pcm_to_alac(codec, buf, entry->frames, &frame, &size)) break;
+
+		entry->offset = ftell(out);
+		entry->size = size;
+		n = fwrite(frame, size, 1, out);
+		free(frame);
+
+		if (n != 1) break;
+		header.count++;
+	}
+
+	if (rc) {
+		u64_t pad = 0;
+
+		// index is accessed in place, so it must be aligned for its u64_t
+		header.index = (ftell(out) + 7) & ~7;
+		rc = (header.index == (u64_t) ftell(out) || fwrite(&pad, header.index - ftell(out), 1, out) == 1) &&
+			 fwrite(index, sizeof(fcache_entry_t), header.count, out) == header.count &&
+			 !fseek(out, 0, SEEK_SET) && fwrite(&header, sizeof(header), 1, out) == 1;
+	}
+
+	if (fclose(out)) rc = false;
+
+#if WIN
+	remove(path);
+#endif
+	if (!rc || rename(tmp, path)) {
+		LOG_ERROR("fcache: cannot build %s", path);
+		remove(tmp);
+		rc = false;
+	} else {
+		LOG_INFO("fcache: %s has %u frames of %d (%Lu bytes of PCM)", path,
+				 header.count, chunk_len, header.length);
+	}
+
+	alac_delete_encoder(codec);
+	if (index) free(index);
+	if (buf) free(buf);
+	free(tmp);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+raop_fcache_t *raop_fcache_open(char *path, char *source, int chunk_len, int sample_rate,
+								int sample_size, int channels)
+{
+	raop_fcache_t *fc;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) || st.st_size < (off_t) sizeof(fcache_header_t)) {
+		LOG_ERROR("fcache: cannot open %s", path);
+		if (fd != -1) close(fd);
+		return NULL;
+	}
+
+	if ((fc = calloc(1, sizeof(raop_fcache_t))) == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	fc->size = st.st_size;
+
+#if WIN
+	setmode(fd, O_BINARY);
+	if ((fc->base = malloc(fc->size)) != NULL && read(fd, fc->base, fc->size) != (int) fc->size) {
+		free(fc->base);
+		fc->base = NULL;
+	}
+#else
+	if ((fc->base = mmap(NULL, fc->size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) fc->base = NULL;
+#endif
+
+	close(fd);
+
+	fc->header = (fcache_header_t*) fc->base;
+
+	// a truncated or foreign file must not make us read anywhere
+	if (!fc->base || strcmp(fc->header->magic, FCACHE_MAGIC) || fc->header->version != FCACHE_VERSION ||
+		fc->header->index < sizeof(fcache_header_t) || fc->header->index > fc->size || fc->header->index % 8 ||
+		(fc->size - fc->header->index) / sizeof(fcache_entry_t) < fc->header->count) {
+		LOG_ERROR("fcache: %s is not a valid cache", path);
+		raop_fcache_close(fc);
+		return NULL;
+	}
+
+	fc->index = (fcache_entry_t*) (fc->base + fc->header->index);
+
+	// frames are only usable by a session of that very format
+	if (fc->header->chunk_len != (u32_t) chunk_len || fc->header->sample_rate != (u32_t) sample_rate ||
+		fc->header->sample_size != sample_size || fc->header->channels != channels) {
+		LOG_WARN("fcache: %s is %u frames of %u at %u/%u/%u, not %d at %d/%d/%d", path,
+				 fc->header->count, fc->header->chunk_len, fc->header->sample_rate, fc->header->sample_size,
+				 fc->header->channels, chunk_len, sample_rate, sample_size, channels);
+		raop_fcache_close(fc);
+		return NULL;
+	}
+
+	if (source && raop_fcache_stale(fc, source)) {
+		LOG_WARN("fcache: %s was not built from %s", path, source);
+		raop_fcache_close(fc);
+		return NULL;
+	}
+
+	LOG_INFO("fcache: opened %s (%u frames of %u)", path, fc->header->count, fc->header->chunk_len);
+
+	return fc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raop_fcache_close(raop_fcache_t *fc)
+{
+	if (!fc) return;
+
+#if WIN
+	if (fc->base) free(fc->base);
+#else
+	if (fc->base) munmap(fc->base, fc->size);
+#endif
+
+	free(fc);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_fcache_info(raop_fcache_t *fc, raop_fcache_info_t *info)
+{
+	if (!fc || !info) return false;
+
+	info->chunk_len = fc->header->chunk_len;
+	info->sample_rate = fc->header->sample_rate;
+	info->sample_size = fc->header->sample_size;
+	info->channels = fc->header->channels;
+	info->hash = fc->header->hash;
+	info->length = fc->header->length;
+	info->count = fc->header->count;
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_fcache_stale(raop_fcache_t *fc, char *source)
+{
+	u64_t hash = FCACHE_HASH_INIT;
+	struct stat st;
+	u8_t buf[16384];
+	int fd, n;
+
+	if (!fc || !source) return true;
+
+	// size is enough most of the time, content is checked otherwise
+	if (stat(source, &st) || (u64_t) st.st_size != fc->header->length ||
+		(fd = open(source, O_RDONLY)) == -1) return true;
+
+#if WIN
+	setmode(fd, O_BINARY);
+#endif
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) hash = fcache_hash(hash, buf, n);
+
+	close(fd);
+
+	if (hash != fc->header->hash) LOG_WARN("fcache: source %s has changed", source);
+
+	return hash != fc->header->hash;
+}
+
+
+/*----------------------------------------------------------------------------*/
+u8_t *raop_fcache_frame(raop_fcache_t *fc, u32_t index, int *size, int *frames)
+{
+	fcache_entry_t *entry;
+
+	if (!fc || index >= fc->header->count) return NULL;
+
+	entry = fc->index + index;
+
+	// offset + size could wrap
+	if (entry->offset > fc->header->index || entry->size > fc->header->index - entry->offset) {
+		LOG_ERROR("fcache: frame %u out of bounds", index);
+		return NULL;
+	}
+
+	*size = entry->size;
+	*frames = entry->frames;
+
+	return fc->base + entry->offset;
+}
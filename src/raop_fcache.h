@@ -0,0 +1,56 @@
+/*****************************************************************************
+ * raop_fcache.h: on-disk cache of encoded audio frames
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+
+#ifndef __RAOP_FCACHE_H_
+#define __RAOP_FCACHE_H_
+
+#include "platform.h"
+
+/*
+ Tracks played often (chimes, announcements ...) can be ALAC-encoded once and
+ stored in a frame cache file: a header, the raw ALAC frames then an index of
+ all frames, in host order. The file is mapped in memory and frames are sent
+ as-is with raopcl_send_encoded, starting at any frame. A cache is keyed by
+ the hash and length of its source PCM and by the format it was encoded for
+ (chunk_len, rate, size, channels), all checked when it is opened
+*/
+
+typedef struct raop_fcache_s raop_fcache_t;
+
+typedef struct {
+	u32_t chunk_len, sample_rate;
+	u16_t sample_size, channels;
+	u64_t hash, length;		// of source PCM
+	u32_t count;			// number of frames
+} raop_fcache_info_t;
+
+// PCM (16 bits little endian, interleaved) read from fd until EOF
+bool	raop_fcache_build(char *path, int fd, int chunk_len, int sample_rate,
+						  int sample_size, int channels);
+// NULL unless made for that format and, when source is not NULL, from that source
+raop_fcache_t *raop_fcache_open(char *path, char *source, int chunk_len, int sample_rate,
+								int sample_size, int channels);
+void	raop_fcache_close(raop_fcache_t *fc);
+bool	raop_fcache_info(raop_fcache_t *fc, raop_fcache_info_t *info);
+// true when the source file does not match what the cache was built from
+bool	raop_fcache_stale(raop_fcache_t *fc, char *source);
+u8_t*	raop_fcache_frame(raop_fcache_t *fc, u32_t index, int *size, int *frames);
+
+#endif
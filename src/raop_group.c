@@ -0,0 +1,342 @@
+/*****************************************************************************
+ * raop_group.c: multi-room group, encode once and send to all
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "log_util.h"
+#include "raop_client.h"
+#include "raop_group.h"
+
+#define SEC(ntp) ((u32_t) ((ntp) >> 32))
+#define FRAC(ntp) ((u32_t) (ntp))
+
+struct raopcl_group_s {
+	pthread_mutex_t mutex;
+	int count;
+	struct {
+		struct raopcl_s *p;
+		int leader;		// index of first member with same encoding
+	} members[RAOP_GROUP_MAX];
+};
+
+extern log_level	raop_loglevel;
+static log_level 	*loglevel = &raop_loglevel;
+
+/*----------------------------------------------------------------------------*/
+static void _group_leaders(raopcl_group_t *g)
+{
+	int i, j;
+
+	for (i = 0; i < g->count; i++) {
+		for (j = 0; j < i && !raopcl_same_encoding(g->members[j].p, g->members[i].p); j++);
+		g->members[i].leader = j;
+	}
+}
+
+
+/*----------------------------------------------------------------------------*/
+raopcl_group_t *raopcl_group_create(void)
+{
+	raopcl_group_t *g = calloc(1, sizeof(raopcl_group_t));
+
+	if (g) pthread_mutex_init(&g->mutex, NULL);
+
+	return g;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raopcl_group_destroy(raopcl_group_t *g)
+{
+	if (!g) return;
+
+	// members are not destroyed, they belong to the caller
+	pthread_mutex_destroy(&g->mutex);
+	free(g);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_add(raopcl_group_t *g, struct raopcl_s *p)
+{
+	bool member;
+	int i;
+
+	if (!g || !p) return false;
+
+	pthread_mutex_lock(&g->mutex);
+
+	for (i = 0; i < g->count && g->members[i].p != p; i++);
+
+	if (i == g->count && g->count < RAOP_GROUP_MAX) {
+		g->members[g->count++].p = p;
+		_group_leaders(g);
+	}
+
+	// false when group was full
+	member = i < g->count;
+
+	pthread_mutex_unlock(&g->mutex);
+
+	LOG_INFO("[%p]: group has %d members", g, g->count);
+
+	return member;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_remove(raopcl_group_t *g, struct raopcl_s *p)
+{
+	int i;
+	bool found = false;
+
+	if (!g || !p) return false;
+
+	pthread_mutex_lock(&g->mutex);
+
+	for (i = 0; i < g->count; i++) {
+		if (g->members[i].p != p) continue;
+		memmove(g->members + i, g->members + i + 1, (g->count - i - 1) * sizeof(g->members[0]));
+		g->count--;
+		found = true;
+		break;
+	}
+
+	// a new leader might take over that encoding
+	_group_leaders(g);
+
+	pthread_mutex_unlock(&g->mutex);
+
+	return found;
+}
+
+
+/*----------------------------------------------------------------------------*/
+int raopcl_group_count(raopcl_group_t *g)
+{
+	return g ? g->count : 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_accept_frames(raopcl_group_t *g)
+{
+	bool accept = true, any = false;
+	int i;
+
+	if (!g) return false;
+
+	pthread_mutex_lock(&g->mutex);
+
+	// all must be asked as accepting is also what moves them to streaming
+	for (i = 0; i < g->count; i++) {
+		struct raopcl_s *p = g->members[i].p;
+
+		if (!raopcl_accept_frames(p)) {
+			if (raopcl_state(p) != RAOP_DOWN) accept = false;
+		} else any = true;
+	}
+
+	pthread_mutex_unlock(&g->mutex);
+
+	return accept && any;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_send_chunk(raopcl_group_t *g, u8_t *sample, int frames, u64_t *playtime)
+{
+	bool rc = false;
+	int i, j;
+
+	if (!g || !sample) return false;
+
+	pthread_mutex_lock(&g->mutex);
+
+	for (i = 0; i < g->count; i++) {
+		u8_t *payload;
+		int size;
+
+		if (g->members[i].leader != i) continue;
+
+		if (!raopcl_encode_chunk(g->members[i].p, sample, frames, &payload, &size)) {
+			LOG_WARN("[%p]: cannot encode for %p", g, g->members[i].p);
+			continue;
+		}
+
+		// send to all members of that encoding
+		for (j = i; j < g->count; j++) {
+			u64_t pt;
+
+			if (g->members[j].leader != i) continue;
+			if (!raopcl_send_payload(g->members[j].p, payload, size, &pt)) continue;
+			if (!rc) *playtime = pt;
+			rc = true;
+		}
+
+		free(payload);
+	}
+
+	pthread_mutex_unlock(&g->mutex);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void *_group_flush_thread(void *arg)
+{
+	return (void*) (long) raopcl_flush((struct raopcl_s*) arg);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _group_flush(raopcl_group_t *g)
+{
+	pthread_t threads[RAOP_GROUP_MAX];
+	bool spawned[RAOP_GROUP_MAX], rc = true;
+	int i;
+
+	// all FLUSH requests are in flight together, don't wait for each answer
+	for (i = 0; i < g->count; i++) {
+		struct raopcl_s *p = g->members[i].p;
+
+		spawned[i] = raopcl_state(p) == RAOP_STREAMING &&
+					 !pthread_create(threads + i, NULL, _group_flush_thread, p);
+
+		if (!spawned[i] && raopcl_state(p) == RAOP_STREAMING) rc &= raopcl_flush(p);
+	}
+
+	for (i = 0; i < g->count; i++) {
+		void *ret;
+
+		if (!spawned[i]) continue;
+		pthread_join(threads[i], &ret);
+		if (!ret) LOG_WARN("[%p]: flush failed for %p", g, g->members[i].p);
+		rc &= ret != NULL;
+	}
+
+	// governors run at flush and may have changed some members' codec
+	_group_leaders(g);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_flush(raopcl_group_t *g)
+{
+	bool rc;
+
+	if (!g) return false;
+
+	pthread_mutex_lock(&g->mutex);
+	rc = _group_flush(g);
+	pthread_mutex_unlock(&g->mutex);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_pause(raopcl_group_t *g)
+{
+	bool rc;
+	int i;
+
+	if (!g) return false;
+
+	// holding the group means no chunk can be sent to some members only
+	pthread_mutex_lock(&g->mutex);
+
+	for (i = 0; i < g->count; i++) raopcl_pause(g->members[i].p);
+	rc = _group_flush(g);
+
+	pthread_mutex_unlock(&g->mutex);
+
+	LOG_INFO("[%p]: paused %d members", g, g->count);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_stop(raopcl_group_t *g)
+{
+	bool rc;
+	int i;
+
+	if (!g) return false;
+
+	pthread_mutex_lock(&g->mutex);
+
+	for (i = 0; i < g->count; i++) raopcl_stop(g->members[i].p);
+	rc = _group_flush(g);
+
+	pthread_mutex_unlock(&g->mutex);
+
+	LOG_INFO("[%p]: stopped %d members", g, g->count);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_resume(raopcl_group_t *g, u64_t start_time)
+{
+	u32_t latency = 0;
+	bool rc = true;
+	int i;
+
+	if (!g) return false;
+
+	if (!start_time) start_time = get_ntp(NULL) + MS2NTP(RAOP_GROUP_RESUME_MS);
+
+	pthread_mutex_lock(&g->mutex);
+
+	/*
+	 A chunk is played at its timestamp + the member's latency, so the same
+	 start time is only sample-aligned if all use the largest latency (which
+	 may have been changed per member by tuning or the capability cache)
+	*/
+	for (i = 0; i < g->count; i++) latency = max(latency, raopcl_latency(g->members[i].p));
+
+	// members may have been flushed on their own since the group last was
+	_group_leaders(g);
+
+	for (i = 0; i < g->count; i++) {
+		struct raopcl_s *p = g->members[i].p;
+
+		if (raopcl_latency(p) != latency && !raopcl_set_latency(p, latency)) {
+			LOG_WARN("[%p]: cannot align latency of %p (%u/%u)", g, p, raopcl_latency(p), latency);
+			rc = false;
+		}
+
+		raopcl_start_at(p, start_time);
+	}
+
+	pthread_mutex_unlock(&g->mutex);
+
+	LOG_INFO("[%p]: resuming at %u.%u (latency:%u)", g, SEC(start_time), FRAC(start_time), latency);
+
+	return rc;
+}
@@ -0,0 +1,65 @@
+/*****************************************************************************
+ * raop_group.h: multi-room group, encode once and send to all
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+
+#ifndef __RAOP_GROUP_H_
+#define __RAOP_GROUP_H_
+
+#include "platform.h"
+#include "raop_client.h"
+
+/*
+ A group is a set of already created (and connected) players that play the
+ same audio. PCM is given once, encoded once per distinct encoding (codec,
+ chunk length and format) by the first member having it, then each member
+ encrypts and stamps it with its own key, sequence, SSRC and timestamps.
+ Members must not be fed individually while they belong to a group
+*/
+
+#define RAOP_GROUP_MAX	32
+
+typedef struct raopcl_group_s raopcl_group_t;
+
+raopcl_group_t *raopcl_group_create(void);
+void	raopcl_group_destroy(raopcl_group_t *g);
+// true when p is a member (already or added), false when group is full
+bool	raopcl_group_add(raopcl_group_t *g, struct raopcl_s *p);
+bool	raopcl_group_remove(raopcl_group_t *g, struct raopcl_s *p);
+int		raopcl_group_count(raopcl_group_t *g);
+// true when all members able to stream accept frames
+bool	raopcl_group_accept_frames(raopcl_group_t *g);
+bool	raopcl_group_send_chunk(raopcl_group_t *g, u8_t *sample, int frames, u64_t *playtime);
+
+/*
+ Transport control applies to all members at once: pause and stop are taken
+ between two chunks (so all members pause at the same audio position) then
+ members are flushed concurrently, which costs one RTSP round-trip whatever
+ their number. raopcl_group_resume anchors all members to the same start
+ time (now + RAOP_GROUP_RESUME_MS when 0) and to the largest latency of them
+ so that they resume sample-aligned (false if one could not be aligned).
+ After a pause/stop, wait for raopcl_group_accept_frames as usual
+*/
+#define RAOP_GROUP_RESUME_MS	250
+
+bool	raopcl_group_pause(raopcl_group_t *g);
+bool	raopcl_group_stop(raopcl_group_t *g);
+bool	raopcl_group_flush(raopcl_group_t *g);
+bool	raopcl_group_resume(raopcl_group_t *g, u64_t start_time);
+
+#endif
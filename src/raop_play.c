@@ -39,6 +39,9 @@
 
 #include "aexcl_lib.h"
 #include "raop_client.h"
+#include "raop_shaper.h"
+#include "raop_pool.h"
+#include "raop_fcache.h"
 #include "alac_wrapper.h"
 
 #define SEC(ntp) ((u32_t) ((ntp) >> 32))
@@ -77,14 +80,29 @@ static int print_usage(char *argv[])
 			   "\t[-p <port number>]\n"
 			   "\t[-v <volume> (0-100)]\n"
 			   "\t[-l <latency> (frames]\n"
+			   "\t[-L] (adapt latency to network at each pause/stop)\n"
+			   "\t[-x <horizon>] (let kernel pace packets up to <horizon> ms ahead - Linux)\n"
+			   "\t[-q <packets>] (encode up to <packets> ahead in a separate thread)\n"
+			   "\t[-W <workers>] (use a pool of <workers> threads to encode ahead)\n"
+			   "\t[-P] (fill player's buffer at start instead of real-time)\n"
+			   "\t[-b <packets>] (autotune socket send buffer, starting at <packets> audio packets)\n"
 			   "\t[-w <wait>]  (start after <wait> milliseconds)\n"
 			   "\t[-n <start>] (start at NTP <start> + <wait>)\n"
 			   "\t[-nf <start>] (start at NTP in <file> + <wait>)\n"
 			   "\t[-e] (encrypt)\n"
    			   "\t[-a] send ALAC compressed audio\n"
+			   "\t[-G] (with -a, adapt ALAC compression to CPU at each pause/stop)\n"
+			   "\t[-B] (input is 16 bits big endian, read directly into packets w/o ALAC)\n"
+			   "\t[-c <cache>] (send ALAC frames from <cache>, checked against <filename> and -f)\n"
+			   "\t[-cs <frame>] (start at <frame> in cache)\n"
+			   "\t[-cb <cache>] (build <cache> from <filename> with -f frames per packet and exit)\n"
+			   "\t[-f <frames>] (frames per packet, default 352, max 4096)\n"
 			   "\t[-s <secret>] (valid secret for AppleTV)\n"
 			   "\t[-t <et>] (et field in mDNS - used to detect MFi)\n"
 			   "\t[-m <[0][,1][,2]>] (md in mDNS: metadata capabilties 0=text, 1=artwork, 2=progress)\n"
+			   "\t[-rc <file>] (cache of receiver capabilities)\n"
+			   "\t[-rn <id>] (identity of receiver in cache, e.g. its mDNS name)\n"
+			   "\t[-sh <kbps>] (pace re-sent audio under <kbps> aggregate rate)\n"
 			   "\t[-d <debug level>] (0 = silent)\n"
 			   "\t[-i] (interactive commands: 'p'=pause, 'r'=(re)start, 's'=stop, 'q'=exit, ' '=block)\n",
 			   name);
@@ -231,6 +249,7 @@ int main(int argc, char *argv[]) {
 	char *fname = NULL;
 	int port = 5000;
 	int volume = 50, wait = 0, latency = MS2TS(1000, 44100);
+	int chunk_len = MAX_SAMPLES_PER_CHUNK, horizon = 0, sndbuf = 0, depth = 0;
 	struct {
 		struct hostent *hostent;
 		char *name;
@@ -242,8 +261,10 @@ int main(int argc, char *argv[]) {
 	enum {STOPPED, PAUSED, PLAYING } status;
 	raop_crypto_t crypto = RAOP_CLEAR;
 	u64_t start = 0, start_at = 0, last = 0, frames = 0;
-	bool interactive = false, alac = false;
-	char *secret = NULL, *md = NULL, *et = NULL;
+	bool interactive = false, alac = false, tuning = false, prefill = false, be = false, governor = false;
+	char *secret = NULL, *md = NULL, *et = NULL, *cache = NULL, *build = NULL, *id = NULL;
+	raop_fcache_t *fcache = NULL;
+	u32_t fcache_index = 0;
 	struct in_addr host = { INADDR_ANY };
 
 	for(i = 1; i < argc; i++){
@@ -272,6 +293,30 @@ int main(int argc, char *argv[]) {
 			latency=atoi(argv[++i]);
 			continue;
 		}
+		if(!strcmp(argv[i],"-L")){
+			tuning = true;
+			continue;
+		}
+		if(!strcmp(argv[i],"-x")){
+			horizon = atoi(argv[++i]);
+			continue;
+		}
+		if(!strcmp(argv[i],"-W")){
+			raop_pool_start(atoi(argv[++i]));
+			continue;
+		}
+		if(!strcmp(argv[i],"-q")){
+			depth = atoi(argv[++i]);
+			continue;
+		}
+		if(!strcmp(argv[i],"-P")){
+			prefill = true;
+			continue;
+		}
+		if(!strcmp(argv[i],"-b")){
+			sndbuf = atoi(argv[++i]);
+			continue;
+		}
 		if(!strcmp(argv[i],"-i")){
 			interactive = true;
 			continue;
@@ -288,6 +333,42 @@ int main(int argc, char *argv[]) {
 			et = argv[++i];
 			continue;
 		}
+		if(!strcmp(argv[i],"-rc")){
+			raopcl_set_cache(argv[++i]);
+			continue;
+		}
+		if(!strcmp(argv[i],"-rn")){
+			id = argv[++i];
+			continue;
+		}
+		if(!strcmp(argv[i],"-sh")){
+			raop_shaper_start(atoi(argv[++i]), 50);
+			continue;
+		}
+		if(!strcmp(argv[i],"-f")){
+			chunk_len = atoi(argv[++i]);
+			continue;
+		}
+		if(!strcmp(argv[i],"-c")){
+			cache = argv[++i];
+			continue;
+		}
+		if(!strcmp(argv[i],"-cs")){
+			fcache_index = atoi(argv[++i]);
+			continue;
+		}
+		if(!strcmp(argv[i],"-cb")){
+			build = argv[++i];
+			continue;
+		}
+		if(!strcmp(argv[i],"-G")){
+			governor = true;
+			continue;
+		}
+		if(!strcmp(argv[i],"-B")){
+			be = true;
+			continue;
+		}
 		if(!strcmp(argv[i],"-a")){
 			alac = true;
 			continue;
@@ -323,6 +404,9 @@ int main(int argc, char *argv[]) {
 		if (!fname) {fname=argv[i]; continue;}
 	}
 
+	// building a cache does not need a player
+	if (build && !fname) fname = player.name;
+
 	if (!player.name) return print_usage(argv);
 	if (!fname) return print_usage(argv);
 
@@ -346,9 +430,26 @@ int main(int argc, char *argv[]) {
 	setmode(infile, O_BINARY);
 #endif
 
+	if (build) {
+		bool rc = raop_fcache_build(build, infile, chunk_len, 44100, 16, 2);
+		close(infile);
+		return rc ? 0 : 1;
+	}
+
+	// cache is only used if it was made from that very source
+	if (cache) {
+		// a pipe can't be checked, the cache is trusted then
+		fcache = raop_fcache_open(cache, strcmp(fname, "-") ? fname : NULL, chunk_len, 44100, 16, 2);
+
+		if (fcache) {
+			alac = true;
+			depth = 0;
+		} else LOG_WARN("cache %s can't be used, encoding from %s", cache, fname);
+	}
+
 	init_platform(interactive);
 
-	if ((raopcl = raopcl_create(host, NULL, NULL, alac ? RAOP_ALAC : RAOP_PCM, MAX_SAMPLES_PER_CHUNK,
+	if ((raopcl = raopcl_create(host, NULL, NULL, alac ? RAOP_ALAC : RAOP_PCM, chunk_len,
 								latency, crypto, false, secret, et, md,
 								44100, 16, 2,
 								raopcl_float_volume(volume))) == NULL) {
@@ -357,6 +458,13 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
+	if (id) raopcl_set_device_id(raopcl, id);
+	if (tuning) raopcl_set_latency_tuning(raopcl, RAOP_TUNING_APPLY);
+	if (governor && !raopcl_set_governor(raopcl, true)) LOG_WARN("compression governor needs ALAC");
+	if (prefill) raopcl_set_prefill(raopcl, true, 250);
+	if (be) raopcl_set_input(raopcl, RAOP_INPUT_S16BE, false);
+	if (depth && !raopcl_set_pipeline(raopcl, depth)) depth = 0;
+
 	player.hostent = gethostbyname(player.name);
 	memcpy(&player.addr.s_addr, player.hostent->h_addr_list[0], player.hostent->h_length);
 
@@ -369,6 +477,14 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
+	if (sndbuf && !raopcl_set_sndbuf(raopcl, sndbuf)) {
+		LOG_WARN("cannot set audio send buffer");
+	}
+
+	if (horizon && !raopcl_set_txtime(raopcl, horizon)) {
+		LOG_WARN("cannot use kernel pacing, check qdisc");
+	}
+
 	latency = raopcl_latency(raopcl);
 
 	LOG_INFO("connected to %s on port %d, player latency is %d ms", inet_ntoa(player.addr),
@@ -391,7 +507,7 @@ int main(int argc, char *argv[]) {
 	start = get_ntp(NULL);
 	status = PLAYING;
 
-	buf = malloc(MAX_SAMPLES_PER_CHUNK*4);
+	buf = malloc(chunk_len*4);
 
 	do {
 		u64_t playtime, now;
@@ -407,13 +523,38 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
-		if (status == PLAYING && raopcl_accept_frames(raopcl)) {
-			n = read(infile, buf, MAX_SAMPLES_PER_CHUNK*4);
-			if (!n)	continue;
-			raopcl_send_chunk(raopcl, buf, n / 4, &playtime);
+		// keep the encoder busy ahead of the pacer
+		while (depth && n && status == PLAYING && raopcl_queued_chunks(raopcl) < depth) {
+			if ((n = read(infile, buf, chunk_len*4)) <= 0) break;
+			raopcl_queue_chunk(raopcl, buf, n / 4);
 			frames += n / 4;
 		}
 
+		if (status == PLAYING && raopcl_accept_frames(raopcl)) {
+			u8_t *direct;
+			int max;
+
+			if (depth) raopcl_send_queued(raopcl, &playtime);
+			else if (fcache) {
+				u8_t *frame = raop_fcache_frame(fcache, fcache_index, &n, &max);
+				if (!frame) n = 0;
+				if (!n) continue;
+				fcache_index++;
+				raopcl_send_encoded(raopcl, frame, n, max, &playtime);
+				frames += max;
+			} else if ((direct = raopcl_get_buffer(raopcl, &max)) != NULL) {
+				n = read(infile, direct, max*4);
+				if (!n) continue;
+				raopcl_commit_buffer(raopcl, n / 4, &playtime);
+				frames += n / 4;
+			} else {
+				n = read(infile, buf, chunk_len*4);
+				if (!n)	continue;
+				raopcl_send_chunk(raopcl, buf, n / 4, &playtime);
+				frames += n / 4;
+			}
+		}
+
 		if (interactive && kbhit()) {
 			char c = _getch();
 
@@ -434,7 +575,11 @@ int main(int argc, char *argv[]) {
 				break;
 			case 'r': {
 				u64_t now = get_ntp(NULL);
-				u64_t start_at = now + MS2NTP(200) - TS2NTP(latency, raopcl_sample_rate(raopcl));
+				u64_t start_at;
+
+				// might have been changed by tuning when flushed
+				latency = raopcl_latency(raopcl);
+				start_at = now + MS2NTP(200) - TS2NTP(latency, raopcl_sample_rate(raopcl));
 
 				status = PLAYING;
 				raopcl_start_at(raopcl, start_at);
@@ -454,10 +599,13 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
-	} while (n || raopcl_is_playing(raopcl));
+	} while (n || raopcl_queued_chunks(raopcl) || raopcl_is_playing(raopcl));
 
 	raopcl_disconnect(raopcl);
 	raopcl_destroy(raopcl);
+	raop_pool_stop();
+	raop_shaper_stop();
+	raop_fcache_close(fcache);
 	free(buf);
 
 	close_platform(interactive);
@@ -0,0 +1,324 @@
+/*****************************************************************************
+ * raop_pool.c: process-wide encoding worker pool
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "log_util.h"
+#include "raop_pool.h"
+
+#define POOL_QUEUE	256
+
+#define NTP2US(ntp) ((((ntp) >> 16) * 1000000) >> 16)
+
+typedef struct {
+	raop_job_t job;
+	void *arg;
+	u64_t deadline, submitted;
+} pool_job_t;
+
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pool_job_t jobs[POOL_QUEUE];
+	int count;
+} pool_worker_t;
+
+extern log_level	raop_loglevel;
+static log_level 	*loglevel = &raop_loglevel;
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool running;
+	int count, pending, owners;
+	pool_worker_t *workers;
+	struct {
+		u32_t jobs, stolen, late;
+		u64_t wait, run;
+		u32_t wait_max, run_max;
+	} stats;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0, 0, 0, NULL, { 0 } };
+
+/*----------------------------------------------------------------------------*/
+static bool _pool_take(pool_worker_t *worker, pool_job_t *job)
+{
+	int i, best = -1;
+
+	pthread_mutex_lock(&worker->mutex);
+
+	// queues are short, a linear search for earliest deadline is fine
+	for (i = 0; i < worker->count; i++) {
+		if (best < 0 || worker->jobs[i].deadline < worker->jobs[best].deadline) best = i;
+	}
+
+	if (best >= 0) {
+		*job = worker->jobs[best];
+		worker->jobs[best] = worker->jobs[--worker->count];
+	}
+
+	pthread_mutex_unlock(&worker->mutex);
+
+	return best >= 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void *_pool_thread(void *args)
+{
+	pool_worker_t *self = (pool_worker_t*) args;
+	int index = self - pool.workers;
+
+	// the pool lock is held whenever running is tested
+	pthread_mutex_lock(&pool.mutex);
+
+	while (pool.running) {
+		u64_t start, end;
+		bool stolen = false;
+		pool_job_t job;
+		int i;
+
+		pthread_mutex_unlock(&pool.mutex);
+
+		// own queue first, then the others starting with next one
+		if (!_pool_take(self, &job)) {
+			for (i = 1; i < pool.count; i++) {
+				if (_pool_take(pool.workers + (index + i) % pool.count, &job)) break;
+			}
+
+			if (i == pool.count) {
+				pthread_mutex_lock(&pool.mutex);
+				if (pool.running && !pool.pending) pthread_cond_wait(&pool.cond, &pool.mutex);
+				continue;
+			}
+
+			stolen = true;
+		}
+
+		pthread_mutex_lock(&pool.mutex);
+		pool.pending--;
+		pthread_mutex_unlock(&pool.mutex);
+
+		start = get_ntp(NULL);
+		job.job(job.arg);
+		end = get_ntp(NULL);
+
+		pthread_mutex_lock(&pool.mutex);
+		pool.stats.jobs++;
+		if (stolen) pool.stats.stolen++;
+		if (start > job.deadline) pool.stats.late++;
+		pool.stats.wait += NTP2US(start - job.submitted);
+		pool.stats.run += NTP2US(end - start);
+		pool.stats.wait_max = max(pool.stats.wait_max, NTP2US(start - job.submitted));
+		pool.stats.run_max = max(pool.stats.run_max, NTP2US(end - start));
+	}
+
+	pthread_mutex_unlock(&pool.mutex);
+
+	return NULL;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_pool_start(int workers)
+{
+	int i;
+
+	if (workers <= 0) return false;
+
+	workers = min(workers, RAOP_POOL_MAX_WORKERS);
+
+	pthread_mutex_lock(&pool.mutex);
+
+	if (pool.running || (pool.workers = calloc(workers, sizeof(pool_worker_t))) == NULL) {
+		pthread_mutex_unlock(&pool.mutex);
+		return false;
+	}
+
+	memset(&pool.stats, 0, sizeof(pool.stats));
+	pool.count = workers;
+	pool.pending = pool.owners = 0;
+	pool.running = true;
+
+	// workers wait for the lock before looking at running or at any queue
+	for (i = 0; i < workers; i++) pthread_mutex_init(&pool.workers[i].mutex, NULL);
+	for (i = 0; i < workers; i++) pthread_create(&pool.workers[i].thread, NULL, _pool_thread, pool.workers + i);
+
+	pthread_mutex_unlock(&pool.mutex);
+
+	LOG_INFO("pool: %d workers", workers);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_pool_stop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&pool.mutex);
+
+	// an attached owner might wait forever for a job that won't run
+	if (!pool.running || pool.owners) {
+		if (pool.owners) LOG_ERROR("pool: %d owners still attached", pool.owners);
+		pthread_mutex_unlock(&pool.mutex);
+		return false;
+	}
+
+	pool.running = false;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+
+	// a worker still running can steal from any queue, so no queue lock goes before all are joined
+	for (i = 0; i < pool.count; i++) pthread_join(pool.workers[i].thread, NULL);
+
+	for (i = 0; i < pool.count; i++) {
+		if (pool.workers[i].count) LOG_WARN("pool: %d jobs left in worker %d", pool.workers[i].count, i);
+		pthread_mutex_destroy(&pool.workers[i].mutex);
+	}
+
+	free(pool.workers);
+	pool.workers = NULL;
+	pool.count = 0;
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_pool_active(void)
+{
+	bool running;
+
+	pthread_mutex_lock(&pool.mutex);
+	running = pool.running;
+	pthread_mutex_unlock(&pool.mutex);
+
+	return running;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_pool_attach(void *arg)
+{
+	bool rc;
+
+	pthread_mutex_lock(&pool.mutex);
+	rc = pool.running;
+	if (rc) pool.owners++;
+	pthread_mutex_unlock(&pool.mutex);
+
+	LOG_DEBUG("pool: attach %p (%s)", arg, rc ? "ok" : "not running");
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raop_pool_detach(void *arg)
+{
+	pthread_mutex_lock(&pool.mutex);
+	if (pool.owners) pool.owners--;
+	pthread_mutex_unlock(&pool.mutex);
+
+	LOG_DEBUG("pool: detach %p", arg);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_pool_submit(raop_job_t job, void *arg, u64_t deadline)
+{
+	pool_worker_t *worker;
+	bool rc = false;
+
+	if (!pool.running) return false;
+
+	// same owner goes to same worker, others will steal if needed
+	worker = pool.workers + ((unsigned long) arg / 64) % pool.count;
+
+	pthread_mutex_lock(&worker->mutex);
+	if (worker->count < POOL_QUEUE) {
+		pool_job_t *p = worker->jobs + worker->count++;
+		p->job = job;
+		p->arg = arg;
+		p->deadline = deadline;
+		p->submitted = get_ntp(NULL);
+		rc = true;
+	}
+	pthread_mutex_unlock(&worker->mutex);
+
+	if (rc) {
+		pthread_mutex_lock(&pool.mutex);
+		pool.pending++;
+		pthread_cond_signal(&pool.cond);
+		pthread_mutex_unlock(&pool.mutex);
+	}
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+int raop_pool_cancel(void *arg)
+{
+	int i, j, removed = 0;
+
+	if (!pool.running) return 0;
+
+	for (i = 0; i < pool.count; i++) {
+		pool_worker_t *worker = pool.workers + i;
+
+		pthread_mutex_lock(&worker->mutex);
+		for (j = 0; j < worker->count; j++) {
+			if (worker->jobs[j].arg != arg) continue;
+			worker->jobs[j--] = worker->jobs[--worker->count];
+			removed++;
+		}
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.pending -= removed;
+	pthread_mutex_unlock(&pool.mutex);
+
+	return removed;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_pool_get_stats(raop_pool_stats_t *stats)
+{
+	if (!stats) return false;
+
+	pthread_mutex_lock(&pool.mutex);
+	stats->jobs = pool.stats.jobs;
+	stats->stolen = pool.stats.stolen;
+	stats->late = pool.stats.late;
+	stats->wait_avg = pool.stats.jobs ? pool.stats.wait / pool.stats.jobs : 0;
+	stats->run_avg = pool.stats.jobs ? pool.stats.run / pool.stats.jobs : 0;
+	stats->wait_max = pool.stats.wait_max;
+	stats->run_max = pool.stats.run_max;
+	stats->pending = pool.pending;
+	pthread_mutex_unlock(&pool.mutex);
+
+	return true;
+}
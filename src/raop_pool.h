@@ -0,0 +1,58 @@
+/*****************************************************************************
+ * raop_pool.h: process-wide encoding worker pool
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+
+#ifndef __RAOP_POOL_H_
+#define __RAOP_POOL_H_
+
+#include "platform.h"
+
+/*
+ A few workers shared by all sessions to encode (and encrypt) ahead. Each
+ worker has its own queue where jobs of a given owner land by default, it
+ always runs the job with the earliest deadline (NTP) and when its queue is
+ empty, it steals the most urgent job of another worker. A session only has
+ one job in the pool at a time, so its encoder is never used concurrently.
+ Owners must attach before submitting and detach once their last job is
+ cancelled or done, raop_pool_stop fails while some are still attached (so
+ all pipelines must be stopped first)
+*/
+
+#define RAOP_POOL_MAX_WORKERS	32
+
+typedef void (*raop_job_t)(void *arg);
+
+typedef struct {
+	u32_t jobs, stolen, late;
+	u32_t wait_avg, wait_max;	// us between submit and start
+	u32_t run_avg, run_max;		// us to execute
+	u32_t pending;
+} raop_pool_stats_t;
+
+bool	raop_pool_start(int workers);
+bool	raop_pool_stop(void);
+bool	raop_pool_active(void);
+bool	raop_pool_attach(void *arg);
+void	raop_pool_detach(void *arg);
+bool	raop_pool_submit(raop_job_t job, void *arg, u64_t deadline);
+// remove queued (not running) jobs of arg, returns how many were removed
+int		raop_pool_cancel(void *arg);
+bool	raop_pool_get_stats(raop_pool_stats_t *stats);
+
+#endif
@@ -0,0 +1,290 @@
+/*****************************************************************************
+ * raop_shaper.c: process-wide pacing of non-urgent traffic
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "log_util.h"
+#include "aexcl_lib.h"
+#include "raop_shaper.h"
+
+#define SHAPER_MAX_QUEUE	4096
+#define SHAPER_MIN_WAIT		500
+#define SHAPER_MAX_WAIT		10000
+
+typedef struct {
+	void *owner;
+	int fd;
+	bool to;
+	struct sockaddr_in addr;
+	u8_t *data;
+	int size;
+} shaper_item_t;
+
+extern log_level	raop_loglevel;
+static log_level 	*loglevel = &raop_loglevel;
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+	u32_t rate, burst;		// bytes/s and bytes
+	s64_t tokens;
+	u64_t last;				// us
+	shaper_item_t *queue;
+	int head, count;
+	raop_shaper_stats_t stats;
+} shaper = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/*----------------------------------------------------------------------------*/
+static u64_t _shaper_now(void)
+{
+	return ((get_ntp(NULL) >> 16) * 1000000) >> 16;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _shaper_refill(void)
+{
+	u64_t now = _shaper_now();
+
+	if (now > shaper.last) {
+		shaper.tokens += ((now - shaper.last) * shaper.rate) / 1000000;
+		if (shaper.tokens > shaper.burst) shaper.tokens = shaper.burst;
+	}
+
+	shaper.last = now;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void *_shaper_thread(void *args)
+{
+	(void) args;
+
+	pthread_mutex_lock(&shaper.mutex);
+
+	while (shaper.running) {
+		u32_t wait = 0;
+
+		if (!shaper.count) {
+			pthread_cond_wait(&shaper.cond, &shaper.mutex);
+			continue;
+		}
+
+		_shaper_refill();
+
+		// sockets are non-blocking, so it's fine to send under the lock which
+		// guarantees that a purged owner's socket is never used afterwards
+		while (shaper.count && shaper.tokens > 0) {
+			shaper_item_t *item = shaper.queue + shaper.head;
+			int n;
+
+			if (item->to) n = sendto(item->fd, (void*) item->data, item->size, 0,
+									 (struct sockaddr*) &item->addr, sizeof(item->addr));
+			else n = send(item->fd, (void*) item->data, item->size, 0);
+
+			if (n == item->size) shaper.stats.sent++;
+			else shaper.stats.dropped++;
+
+			shaper.tokens -= item->size;
+			free(item->data);
+			shaper.head = (shaper.head + 1) % SHAPER_MAX_QUEUE;
+			shaper.count--;
+		}
+
+		// sleep until enough tokens for next packet
+		if (shaper.count) {
+			wait = ((u64_t) (shaper.queue[shaper.head].size - shaper.tokens) * 1000000) / shaper.rate;
+			wait = min(max(wait, SHAPER_MIN_WAIT), SHAPER_MAX_WAIT);
+		}
+
+		pthread_mutex_unlock(&shaper.mutex);
+		if (wait) usleep(wait);
+		pthread_mutex_lock(&shaper.mutex);
+	}
+
+	pthread_mutex_unlock(&shaper.mutex);
+
+	return NULL;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_shaper_start(u32_t rate_kbps, u32_t burst_ms)
+{
+	bool rc = true;
+
+	if (!rate_kbps) return false;
+
+	pthread_mutex_lock(&shaper.mutex);
+
+	shaper.rate = rate_kbps * 125;
+	shaper.burst = max((u64_t) shaper.rate * burst_ms / 1000, 1500);
+
+	if (!shaper.running) {
+		shaper.tokens = shaper.burst;
+		shaper.last = _shaper_now();
+		shaper.head = shaper.count = 0;
+		memset(&shaper.stats, 0, sizeof(shaper.stats));
+
+		if ((shaper.queue = calloc(SHAPER_MAX_QUEUE, sizeof(shaper_item_t))) == NULL) rc = false;
+		else {
+			shaper.running = true;
+			pthread_create(&shaper.thread, NULL, _shaper_thread, NULL);
+		}
+	}
+
+	pthread_mutex_unlock(&shaper.mutex);
+
+	LOG_INFO("shaper: %u kbps, burst %u bytes", rate_kbps, shaper.burst);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raop_shaper_stop(void)
+{
+	pthread_mutex_lock(&shaper.mutex);
+
+	if (!shaper.running) {
+		pthread_mutex_unlock(&shaper.mutex);
+		return;
+	}
+
+	shaper.running = false;
+	pthread_cond_signal(&shaper.cond);
+	pthread_mutex_unlock(&shaper.mutex);
+
+	pthread_join(shaper.thread, NULL);
+
+	// what's left is not sent, owners will re-send on NACK anyway
+	for (; shaper.count; shaper.count--) {
+		free(shaper.queue[shaper.head].data);
+		shaper.head = (shaper.head + 1) % SHAPER_MAX_QUEUE;
+	}
+
+	free(shaper.queue);
+	shaper.queue = NULL;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_shaper_active(void)
+{
+	return shaper.running;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raop_shaper_consume(int size)
+{
+	if (!shaper.running) return;
+
+	pthread_mutex_lock(&shaper.mutex);
+
+	// real-time is already gone, it just delays the rest (bounded debt)
+	_shaper_refill();
+	shaper.tokens -= size;
+	if (shaper.tokens < -(s64_t) shaper.burst) shaper.tokens = -(s64_t) shaper.burst;
+
+	pthread_mutex_unlock(&shaper.mutex);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_shaper_queue(void *owner, int fd, struct sockaddr_in *addr, void *data, int size)
+{
+	shaper_item_t *item;
+	bool rc = false;
+
+	if (!shaper.running || fd == -1) return false;
+
+	pthread_mutex_lock(&shaper.mutex);
+
+	if (shaper.running && shaper.count < SHAPER_MAX_QUEUE) {
+		item = shaper.queue + (shaper.head + shaper.count) % SHAPER_MAX_QUEUE;
+
+		// a copy is needed as backlog slots are recycled
+		if ((item->data = malloc(size)) != NULL) {
+			memcpy(item->data, data, size);
+			item->size = size;
+			item->owner = owner;
+			item->fd = fd;
+			item->to = addr != NULL;
+			if (addr) item->addr = *addr;
+
+			shaper.count++;
+			shaper.stats.queued++;
+			pthread_cond_signal(&shaper.cond);
+			rc = true;
+		}
+	}
+
+	pthread_mutex_unlock(&shaper.mutex);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raop_shaper_purge(void *owner)
+{
+	int i, n;
+
+	if (!shaper.running) return;
+
+	pthread_mutex_lock(&shaper.mutex);
+
+	// compact in place, keeping order of what remains
+	for (i = n = 0; i < shaper.count; i++) {
+		shaper_item_t *item = shaper.queue + (shaper.head + i) % SHAPER_MAX_QUEUE;
+
+		if (item->owner == owner) {
+			free(item->data);
+			shaper.stats.purged++;
+			continue;
+		}
+
+		if (i != n) shaper.queue[(shaper.head + n) % SHAPER_MAX_QUEUE] = *item;
+		n++;
+	}
+
+	shaper.count = n;
+
+	pthread_mutex_unlock(&shaper.mutex);
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raop_shaper_get_stats(raop_shaper_stats_t *stats)
+{
+	if (!stats) return false;
+
+	pthread_mutex_lock(&shaper.mutex);
+	*stats = shaper.stats;
+	stats->pending = shaper.count;
+	pthread_mutex_unlock(&shaper.mutex);
+
+	return true;
+}
@@ -0,0 +1,50 @@
+/*****************************************************************************
+ * raop_shaper.h: process-wide pacing of non-urgent traffic
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+
+#ifndef __RAOP_SHAPER_H_
+#define __RAOP_SHAPER_H_
+
+#include "platform.h"
+
+/*
+ When many sessions start or resume together, what they send on top of the
+ real-time flow (retransmits, re-sent window, prefill) comes all at once and
+ can overflow the access point's queue. When started, the shaper is a single
+ token bucket for the whole process: real-time packets are never delayed but
+ take their share of tokens, non-urgent ones are queued and sent by a worker
+ only when tokens are available. When not started, everything goes directly
+*/
+
+typedef struct {
+	u32_t queued, sent, dropped, purged;
+	u32_t pending;
+} raop_shaper_stats_t;
+
+bool	raop_shaper_start(u32_t rate_kbps, u32_t burst_ms);
+void	raop_shaper_stop(void);
+bool	raop_shaper_active(void);
+void	raop_shaper_consume(int size);
+// addr can be NULL for a connected socket, false means caller must send
+bool	raop_shaper_queue(void *owner, int fd, struct sockaddr_in *addr, void *data, int size);
+// owner must purge before closing any socket it queued with
+void	raop_shaper_purge(void *owner);
+bool	raop_shaper_get_stats(raop_shaper_stats_t *stats);
+
+#endif
@@ -0,0 +1,934 @@
+/*****************************************************************************
+ * raop_tx.c: shared audio transmit engine
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#if defined(linux)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "log_util.h"
+#include "aexcl_lib.h"
+#include "raop_tx.h"
+
+#if LINUX && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifndef URING
+#define URING 0
+#endif
+
+#if LINUX && defined(__has_include)
+#if __has_include(<linux/if_xdp.h>)
+#define XDP 1
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_xdp.h>
+#ifndef AF_XDP
+#define AF_XDP	44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP	283
+#endif
+#define XDP_FRAMES		512
+#define XDP_FRAME_SIZE	2048
+#define XDP_NEIGHBOURS	32
+#define XDP_NEIGH_TTL	30
+#endif
+#endif
+
+#ifndef XDP
+#define XDP 0
+#endif
+
+#if XDP
+typedef struct {
+	u32_t *producer, *consumer;
+	void *ring, *map;
+	size_t map_size;
+} xdp_ring_t;
+#endif
+
+typedef struct {
+	struct sockaddr_in addr;
+	u8_t *data;
+	int size, alloc;
+} raoptx_packet_t;
+
+typedef struct raoptx_s {
+	pthread_mutex_t mutex;
+	int fd;
+	struct in_addr local;
+	u16_t port;
+	int batch, count;
+	raoptx_packet_t *queue;
+#if LINUX
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+#endif
+	raoptx_backend_t backend;
+#if URING
+	struct {
+		int fd;
+		void *sq_ring, *cq_ring;
+		size_t sq_size, cq_size;
+		struct io_uring_sqe *sqes;
+		size_t sqes_size;
+		u32_t *sq_head, *sq_tail, *sq_mask, *sq_array;
+		u32_t *cq_head, *cq_tail, *cq_mask;
+		struct io_uring_cqe *cqes;
+	} uring;
+#endif
+#if XDP
+	struct {
+		int fd, ifindex, mtu;
+		u8_t mac[ETH_ALEN];
+		struct in_addr mask, gateway;
+		u16_t id;
+		u8_t *umem;
+		xdp_ring_t tx, cq, fq;
+		u64_t frames[XDP_FRAMES];
+		int free;
+		struct {
+			struct in_addr addr;
+			u8_t mac[ETH_ALEN];
+			time_t at;
+		} neighbours[XDP_NEIGHBOURS];
+		int count;
+	} xdp;
+#endif
+	raoptx_stats_t stats;
+} raoptx_t;
+
+extern log_level	raop_loglevel;
+static log_level 	*loglevel = &raop_loglevel;
+
+static int  _raoptx_sent(raoptx_t *tx, int sent);
+#if URING
+static bool _uring_open(raoptx_t *tx);
+static void _uring_close(raoptx_t *tx);
+static int  _uring_flush(raoptx_t *tx);
+#endif
+#if XDP
+static bool _xdp_open(raoptx_t *tx);
+static void _xdp_close(raoptx_t *tx);
+static int  _xdp_flush(raoptx_t *tx);
+#endif
+
+/*----------------------------------------------------------------------------*/
+struct raoptx_s *raoptx_create(struct in_addr local, int batch)
+{
+	raoptx_t *tx;
+	u16_t port = 0;
+
+	if ((tx = calloc(1, sizeof(raoptx_t))) == NULL) return NULL;
+
+	tx->batch = batch > 0 ? min(batch, RAOPTX_MAX_BATCH) : RAOPTX_MAX_BATCH;
+	tx->queue = calloc(tx->batch, sizeof(*tx->queue));
+#if LINUX
+	tx->msgs = calloc(tx->batch, sizeof(struct mmsghdr));
+	tx->iovs = calloc(tx->batch, sizeof(struct iovec));
+	if (!tx->msgs || !tx->iovs) tx->batch = 0;
+#endif
+
+	if (!tx->queue || !tx->batch || (tx->fd = open_udp_socket(local, &port, false)) == -1) {
+		LOG_ERROR("cannot create transmit engine");
+		tx->fd = -1;
+		raoptx_destroy(tx);
+		return NULL;
+	}
+
+	pthread_mutex_init(&tx->mutex, NULL);
+	tx->backend = RAOPTX_SENDMMSG;
+	tx->local = local;
+	tx->port = port;
+#if URING
+	tx->uring.fd = -1;
+#endif
+#if XDP
+	tx->xdp.fd = -1;
+#endif
+
+	LOG_INFO("[%p]: transmit engine on port %hu (batch %d)", tx, port, tx->batch);
+
+	return tx;
+}
+
+
+/*----------------------------------------------------------------------------*/
+void raoptx_destroy(struct raoptx_s *tx)
+{
+	int i;
+
+	if (!tx) return;
+
+	if (tx->fd != -1) {
+		raoptx_flush(tx);
+#if URING
+		_uring_close(tx);
+#endif
+#if XDP
+		_xdp_close(tx);
+#endif
+		closesocket(tx->fd);
+		pthread_mutex_destroy(&tx->mutex);
+	}
+
+	for (i = 0; tx->queue && i < tx->batch; i++) free(tx->queue[i].data);
+
+	free(tx->queue);
+#if LINUX
+	free(tx->msgs);
+	free(tx->iovs);
+#endif
+	free(tx);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static int _raoptx_flush(raoptx_t *tx)
+{
+	int i, sent = 0;
+
+	if (!tx->count) return 0;
+
+#if URING
+	if (tx->backend == RAOPTX_URING) return _uring_flush(tx);
+#endif
+#if XDP
+	if (tx->backend == RAOPTX_XDP) return _xdp_flush(tx);
+#endif
+
+#if LINUX
+	for (i = 0; i < tx->count; i++) {
+		struct msghdr *msg = &tx->msgs[i].msg_hdr;
+
+		tx->iovs[i].iov_base = tx->queue[i].data;
+		tx->iovs[i].iov_len = tx->queue[i].size;
+		memset(msg, 0, sizeof(struct msghdr));
+		msg->msg_name = &tx->queue[i].addr;
+		msg->msg_namelen = sizeof(struct sockaddr_in);
+		msg->msg_iov = tx->iovs + i;
+		msg->msg_iovlen = 1;
+	}
+
+	// sendmmsg stops at first failure, so go on with the rest
+	while (sent < tx->count) {
+		int n = sendmmsg(tx->fd, tx->msgs + sent, tx->count - sent, 0);
+
+		tx->stats.syscalls++;
+
+		if (n > 0) {
+			sent += n;
+			continue;
+		}
+
+		if (last_error() == ERROR_WOULDBLOCK) break;
+
+		// skip the faulty one (e.g. ICMP from a player gone away)
+		LOG_DEBUG("[%p]: cannot send to %s (%s)", tx, inet_ntoa(tx->queue[sent].addr.sin_addr), strerror(errno));
+		tx->stats.dropped++;
+		sent++;
+	}
+#else
+	for (i = 0; i < tx->count; i++, sent++) {
+		int n = sendto(tx->fd, (void*) tx->queue[i].data, tx->queue[i].size, 0,
+					   (struct sockaddr*) &tx->queue[i].addr, sizeof(struct sockaddr_in));
+
+		tx->stats.syscalls++;
+		if (n == -1 && last_error() == ERROR_WOULDBLOCK) break;
+		if (n != tx->queue[i].size) tx->stats.dropped++;
+	}
+#endif
+
+	return _raoptx_sent(tx, sent);
+}
+
+
+/*----------------------------------------------------------------------------*/
+static int _raoptx_sent(raoptx_t *tx, int sent)
+{
+	int i;
+
+	tx->stats.sent += sent;
+	tx->stats.flushes++;
+
+	// socket is full, keep the rest (in order) for next tick
+	if (sent < tx->count) {
+		for (i = 0; i < tx->count - sent; i++) {
+			u8_t *data = tx->queue[i].data;
+			int alloc = tx->queue[i].alloc;
+
+			tx->queue[i] = tx->queue[i + sent];
+			tx->queue[i + sent].data = data;
+			tx->queue[i + sent].alloc = alloc;
+		}
+	}
+
+	tx->count -= sent;
+
+	return sent;
+}
+
+
+/*----------------------------------------------------------------------------*/
+int raoptx_flush(struct raoptx_s *tx)
+{
+	int sent;
+
+	if (!tx) return -1;
+
+	pthread_mutex_lock(&tx->mutex);
+	sent = _raoptx_flush(tx);
+	pthread_mutex_unlock(&tx->mutex);
+
+	return sent;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raoptx_queue(struct raoptx_s *tx, struct sockaddr_in *addr, void *data, int size)
+{
+	bool rc = true;
+
+	if (!tx) return false;
+
+	pthread_mutex_lock(&tx->mutex);
+
+	// batch is full, can't wait for the tick
+	if (tx->count == tx->batch) _raoptx_flush(tx);
+
+	if (tx->count < tx->batch) {
+		int i = tx->count;
+
+		// packet must be copied as caller's backlog might be re-used
+		if (tx->queue[i].alloc < size) {
+			u8_t *data = realloc(tx->queue[i].data, size);
+			if (data) {
+				tx->queue[i].data = data;
+				tx->queue[i].alloc = size;
+			}
+		}
+
+		if (tx->queue[i].alloc >= size) {
+			memcpy(tx->queue[i].data, data, size);
+			tx->queue[i].size = size;
+			tx->queue[i].addr = *addr;
+			tx->count++;
+			tx->stats.queued++;
+		} else rc = false;
+	} else rc = false;
+
+	if (!rc) tx->stats.dropped++;
+
+	pthread_mutex_unlock(&tx->mutex);
+
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+raoptx_backend_t raoptx_set_backend(struct raoptx_s *tx, raoptx_backend_t backend)
+{
+	raoptx_backend_t current;
+
+	if (!tx) return RAOPTX_SENDMMSG;
+
+	pthread_mutex_lock(&tx->mutex);
+
+	// whatever is pending leaves with the current backend
+	_raoptx_flush(tx);
+
+	if (backend != tx->backend) {
+#if URING
+		if (tx->backend == RAOPTX_URING) _uring_close(tx);
+#endif
+#if XDP
+		if (tx->backend == RAOPTX_XDP) _xdp_close(tx);
+#endif
+		tx->backend = RAOPTX_SENDMMSG;
+
+		if (backend == RAOPTX_URING) {
+#if URING
+			if (_uring_open(tx)) tx->backend = RAOPTX_URING;
+			else
+#endif
+			LOG_WARN("[%p]: io_uring not available, using sendmmsg", tx);
+		} else if (backend == RAOPTX_XDP) {
+#if XDP
+			if (_xdp_open(tx)) tx->backend = RAOPTX_XDP;
+			else
+#endif
+			LOG_WARN("[%p]: AF_XDP not available, using sendmmsg", tx);
+		}
+	}
+
+	current = tx->backend;
+
+	pthread_mutex_unlock(&tx->mutex);
+
+	LOG_INFO("[%p]: transmit backend %s", tx, current == RAOPTX_URING ? "io_uring" :
+			 current == RAOPTX_XDP ? "AF_XDP" : "sendmmsg");
+
+	return current;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool raoptx_get_stats(struct raoptx_s *tx, raoptx_stats_t *stats)
+{
+	if (!tx || !stats) return false;
+
+	pthread_mutex_lock(&tx->mutex);
+	*stats = tx->stats;
+	pthread_mutex_unlock(&tx->mutex);
+
+	return true;
+}
+
+
+#if URING
+/*
+ Experimental, no gain measured over sendmmsg so far. No liburing dependency,
+ the few structures needed are mapped by hand. Each packet is an independent
+ SENDMSG (not linked, so one failure does not cancel the rest of the tick)
+ and the whole batch costs a single io_uring_enter. The ones the socket could
+ not take are kept in order for next tick. There are no registered buffers,
+ multishot receive nor linked timeouts
+*/
+
+/*----------------------------------------------------------------------------*/
+static bool _uring_open(raoptx_t *tx)
+{
+	struct io_uring_params params;
+	u8_t *sq, *cq;
+
+	memset(&params, 0, sizeof(params));
+
+	if ((tx->uring.fd = syscall(__NR_io_uring_setup, tx->batch, &params)) < 0) {
+		LOG_INFO("[%p]: cannot setup io_uring (%s)", tx, strerror(errno));
+		tx->uring.fd = -1;
+		return false;
+	}
+
+	tx->uring.sq_size = params.sq_off.array + params.sq_entries * sizeof(u32_t);
+	tx->uring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	tx->uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		tx->uring.sq_size = tx->uring.cq_size = max(tx->uring.sq_size, tx->uring.cq_size);
+	}
+
+	sq = mmap(NULL, tx->uring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  tx->uring.fd, IORING_OFF_SQ_RING);
+	tx->uring.sq_ring = sq;
+
+	if (sq == MAP_FAILED) {
+		tx->uring.sq_ring = tx->uring.cq_ring = NULL;
+		_uring_close(tx);
+		return false;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) cq = sq;
+	else cq = mmap(NULL, tx->uring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				   tx->uring.fd, IORING_OFF_CQ_RING);
+	tx->uring.cq_ring = cq;
+
+	tx->uring.sqes = mmap(NULL, tx->uring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						  tx->uring.fd, IORING_OFF_SQES);
+
+	if (cq == MAP_FAILED || tx->uring.sqes == MAP_FAILED) {
+		if (cq == MAP_FAILED) tx->uring.cq_ring = NULL;
+		if (tx->uring.sqes == MAP_FAILED) tx->uring.sqes = NULL;
+		_uring_close(tx);
+		return false;
+	}
+
+	tx->uring.sq_head = (u32_t*) (sq + params.sq_off.head);
+	tx->uring.sq_tail = (u32_t*) (sq + params.sq_off.tail);
+	tx->uring.sq_mask = (u32_t*) (sq + params.sq_off.ring_mask);
+	tx->uring.sq_array = (u32_t*) (sq + params.sq_off.array);
+	tx->uring.cq_head = (u32_t*) (cq + params.cq_off.head);
+	tx->uring.cq_tail = (u32_t*) (cq + params.cq_off.tail);
+	tx->uring.cq_mask = (u32_t*) (cq + params.cq_off.ring_mask);
+	tx->uring.cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+	LOG_INFO("[%p]: io_uring with %u entries", tx, params.sq_entries);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _uring_close(raoptx_t *tx)
+{
+	if (tx->uring.sqes) munmap(tx->uring.sqes, tx->uring.sqes_size);
+	if (tx->uring.cq_ring && tx->uring.cq_ring != tx->uring.sq_ring) munmap(tx->uring.cq_ring, tx->uring.cq_size);
+	if (tx->uring.sq_ring) munmap(tx->uring.sq_ring, tx->uring.sq_size);
+	if (tx->uring.fd != -1) close(tx->uring.fd);
+
+	memset(&tx->uring, 0, sizeof(tx->uring));
+	tx->uring.fd = -1;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static int _uring_flush(raoptx_t *tx)
+{
+	u32_t tail = *tx->uring.sq_tail, head;
+	int i, n, sent = 0;
+	bool done[RAOPTX_MAX_BATCH];
+
+	for (i = 0; i < tx->count; i++, tail++) {
+		struct msghdr *msg = &tx->msgs[i].msg_hdr;
+		u32_t index = tail & *tx->uring.sq_mask;
+		struct io_uring_sqe *sqe = tx->uring.sqes + index;
+
+		tx->iovs[i].iov_base = tx->queue[i].data;
+		tx->iovs[i].iov_len = tx->queue[i].size;
+		memset(msg, 0, sizeof(struct msghdr));
+		msg->msg_name = &tx->queue[i].addr;
+		msg->msg_namelen = sizeof(struct sockaddr_in);
+		msg->msg_iov = tx->iovs + i;
+		msg->msg_iovlen = 1;
+
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = tx->fd;
+		sqe->addr = (unsigned long) msg;
+		sqe->len = 1;
+		sqe->user_data = i;
+
+		tx->uring.sq_array[index] = index;
+	}
+
+	__atomic_store_n(tx->uring.sq_tail, tail, __ATOMIC_RELEASE);
+
+	n = syscall(__NR_io_uring_enter, tx->uring.fd, tx->count, tx->count, IORING_ENTER_GETEVENTS, NULL, 0);
+	tx->stats.syscalls++;
+
+	if (n < 0) {
+		LOG_WARN("[%p]: io_uring_enter failed (%s)", tx, strerror(errno));
+		// leave a ring that can't be trusted anymore
+		_uring_close(tx);
+		tx->backend = RAOPTX_SENDMMSG;
+		return _raoptx_flush(tx);
+	}
+
+	// completions are not guaranteed in order, mark then keep what's left
+	memset(done, 0, tx->count * sizeof(bool));
+
+	head = *tx->uring.cq_head;
+
+	while (head != __atomic_load_n(tx->uring.cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = tx->uring.cqes + (head & *tx->uring.cq_mask);
+		int k = cqe->user_data;
+
+		if (k >= 0 && k < tx->count) {
+			if (cqe->res >= 0) done[k] = true;
+			else if (cqe->res != -EAGAIN) {
+				// skip the faulty one (e.g. ICMP from a player gone away)
+				LOG_DEBUG("[%p]: cannot send to %s (%s)", tx, inet_ntoa(tx->queue[k].addr.sin_addr), strerror(-cqe->res));
+				tx->stats.dropped++;
+				done[k] = true;
+			}
+		}
+
+		head++;
+	}
+
+	__atomic_store_n(tx->uring.cq_head, head, __ATOMIC_RELEASE);
+
+	// each entry owns its buffer, so they are swapped, not copied
+	for (i = n = 0; i < tx->count; i++) {
+		raoptx_packet_t packet;
+
+		if (done[i]) continue;
+
+		if (n != i) {
+			packet = tx->queue[n];
+			tx->queue[n] = tx->queue[i];
+			tx->queue[i] = packet;
+		}
+
+		n++;
+	}
+
+	sent = tx->count - n;
+	tx->count = n;
+	tx->stats.sent += sent;
+	tx->stats.flushes++;
+
+	return sent;
+}
+#endif
+
+
+#if XDP
+/*
+ Experimental: audio packets are written as complete Ethernet/IPv4/UDP frames
+ in a UMEM shared with the kernel and pushed through an AF_XDP socket, which
+ skips the whole UDP/IP stack and qdisc. TX needs no XDP program, so any
+ interface (including veth) works in generic (copy) mode; zero-copy is tried
+ first. Only the audio packets use it, RTSP, control and timing stay on their
+ sockets. Packets whose next hop is not in the ARP table yet, or which would
+ need fragmentation, take the regular socket which also triggers ARP. The
+ frames leave from the interface's queue 0 only
+*/
+
+/*----------------------------------------------------------------------------*/
+static bool _xdp_map(int fd, xdp_ring_t *ring, struct xdp_ring_offset *off, size_t size, off_t pgoff)
+{
+	ring->map_size = off->desc + size;
+	ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		return false;
+	}
+
+	ring->producer = (u32_t*) ((u8_t*) ring->map + off->producer);
+	ring->consumer = (u32_t*) ((u8_t*) ring->map + off->consumer);
+	ring->ring = (u8_t*) ring->map + off->desc;
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _xdp_interface(raoptx_t *tx)
+{
+	struct ifaddrs *ifa, *ifap;
+	struct ifreq ifr;
+	char name[IFNAMSIZ] = "";
+	FILE *in;
+
+	if (getifaddrs(&ifap)) return false;
+
+	for (ifa = ifap; ifa; ifa = ifa->ifa_next) {
+		struct sockaddr_in *addr = (struct sockaddr_in*) ifa->ifa_addr;
+
+		if (!addr || !ifa->ifa_netmask || addr->sin_family != AF_INET ||
+			addr->sin_addr.s_addr != tx->local.s_addr) continue;
+
+		strncpy(name, ifa->ifa_name, IFNAMSIZ - 1);
+		tx->xdp.mask = ((struct sockaddr_in*) ifa->ifa_netmask)->sin_addr;
+		break;
+	}
+
+	freeifaddrs(ifap);
+
+	if (!*name || (tx->xdp.ifindex = if_nametoindex(name)) == 0) {
+		LOG_INFO("[%p]: AF_XDP needs an interface address (%s)", tx, inet_ntoa(tx->local));
+		return false;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	if (ioctl(tx->fd, SIOCGIFHWADDR, &ifr) < 0) return false;
+	memcpy(tx->xdp.mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	if (ioctl(tx->fd, SIOCGIFMTU, &ifr) < 0) return false;
+	tx->xdp.mtu = min(ifr.ifr_mtu, XDP_FRAME_SIZE - ETH_HLEN);
+
+	// default gateway of that interface, for players outside of our subnet
+	tx->xdp.gateway.s_addr = INADDR_ANY;
+	if ((in = fopen("/proc/net/route", "r")) != NULL) {
+		char line[256], iface[IFNAMSIZ + 1];
+		unsigned int dest, gateway;
+
+		while (fgets(line, sizeof(line), in)) {
+			if (sscanf(line, "%16s %x %x", iface, &dest, &gateway) != 3) continue;
+			if (strcmp(iface, name) || dest) continue;
+			tx->xdp.gateway.s_addr = gateway;
+			break;
+		}
+		fclose(in);
+	}
+
+	LOG_INFO("[%p]: AF_XDP on %s (index:%d mtu:%d)", tx, name, tx->xdp.ifindex, tx->xdp.mtu);
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _xdp_open(raoptx_t *tx)
+{
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	socklen_t len = sizeof(off);
+	int i, size = XDP_FRAMES;
+
+	memset(&tx->xdp, 0, sizeof(tx->xdp));
+	tx->xdp.fd = -1;
+
+	if (!_xdp_interface(tx)) return false;
+
+	if ((tx->xdp.fd = socket(AF_XDP, SOCK_RAW, 0)) < 0) {
+		LOG_INFO("[%p]: cannot create AF_XDP socket (%s)", tx, strerror(errno));
+		tx->xdp.fd = -1;
+		return false;
+	}
+
+	if (posix_memalign((void**) &tx->xdp.umem, getpagesize(), XDP_FRAMES * XDP_FRAME_SIZE)) {
+		tx->xdp.umem = NULL;
+		_xdp_close(tx);
+		return false;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (unsigned long) tx->xdp.umem;
+	reg.len = XDP_FRAMES * XDP_FRAME_SIZE;
+	reg.chunk_size = XDP_FRAME_SIZE;
+
+	// fill ring is never used but the kernel wants one
+	if (setsockopt(tx->xdp.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) ||
+		setsockopt(tx->xdp.fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) ||
+		setsockopt(tx->xdp.fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) ||
+		setsockopt(tx->xdp.fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) ||
+		getsockopt(tx->xdp.fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len)) {
+		LOG_INFO("[%p]: cannot setup AF_XDP rings (%s)", tx, strerror(errno));
+		_xdp_close(tx);
+		return false;
+	}
+
+	if (!_xdp_map(tx->xdp.fd, &tx->xdp.tx, &off.tx, size * sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) ||
+		!_xdp_map(tx->xdp.fd, &tx->xdp.cq, &off.cr, size * sizeof(u64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+		!_xdp_map(tx->xdp.fd, &tx->xdp.fq, &off.fr, size * sizeof(u64_t), XDP_UMEM_PGOFF_FILL_RING)) {
+		_xdp_close(tx);
+		return false;
+	}
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = tx->xdp.ifindex;
+	sxdp.sxdp_queue_id = 0;
+	sxdp.sxdp_flags = XDP_ZEROCOPY;
+
+	if (bind(tx->xdp.fd, (struct sockaddr*) &sxdp, sizeof(sxdp))) {
+		sxdp.sxdp_flags = XDP_COPY;
+		if (bind(tx->xdp.fd, (struct sockaddr*) &sxdp, sizeof(sxdp))) {
+			LOG_INFO("[%p]: cannot bind AF_XDP socket (%s)", tx, strerror(errno));
+			_xdp_close(tx);
+			return false;
+		}
+	}
+
+	for (i = 0; i < XDP_FRAMES; i++) tx->xdp.frames[i] = i * XDP_FRAME_SIZE;
+	tx->xdp.free = XDP_FRAMES;
+
+	LOG_INFO("[%p]: AF_XDP ready (%s)", tx, sxdp.sxdp_flags == XDP_COPY ? "copy" : "zero-copy");
+
+	return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void _xdp_close(raoptx_t *tx)
+{
+	if (tx->xdp.tx.map) munmap(tx->xdp.tx.map, tx->xdp.tx.map_size);
+	if (tx->xdp.cq.map) munmap(tx->xdp.cq.map, tx->xdp.cq.map_size);
+	if (tx->xdp.fq.map) munmap(tx->xdp.fq.map, tx->xdp.fq.map_size);
+	if (tx->xdp.fd != -1) close(tx->xdp.fd);
+	free(tx->xdp.umem);
+
+	memset(&tx->xdp, 0, sizeof(tx->xdp));
+	tx->xdp.fd = -1;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static bool _xdp_neighbour(raoptx_t *tx, struct in_addr addr, u8_t *mac)
+{
+	time_t now = time(NULL);
+	char line[256];
+	FILE *in;
+	int i;
+
+	// route through gateway when player is not on our subnet
+	if ((addr.s_addr & tx->xdp.mask.s_addr) != (tx->local.s_addr & tx->xdp.mask.s_addr)) {
+		if (tx->xdp.gateway.s_addr == INADDR_ANY) return false;
+		addr = tx->xdp.gateway;
+	}
+
+	for (i = 0; i < tx->xdp.count; i++) {
+		if (tx->xdp.neighbours[i].addr.s_addr != addr.s_addr) continue;
+		if (now - tx->xdp.neighbours[i].at < XDP_NEIGH_TTL) {
+			memcpy(mac, tx->xdp.neighbours[i].mac, ETH_ALEN);
+			return true;
+		}
+		break;
+	}
+
+	if ((in = fopen("/proc/net/arp", "r")) == NULL) return false;
+
+	while (fgets(line, sizeof(line), in)) {
+		char ip[32], hw[32];
+		unsigned int type, flags, m[ETH_ALEN];
+		int j;
+
+		if (sscanf(line, "%31s 0x%x 0x%x %31s", ip, &type, &flags, hw) != 4) continue;
+		// only complete entries (ATF_COM)
+		if (inet_addr(ip) != addr.s_addr || !(flags & 0x02)) continue;
+		if (sscanf(hw, "%x:%x:%x:%x:%x:%x", m, m + 1, m + 2, m + 3, m + 4, m + 5) != ETH_ALEN) continue;
+
+		for (j = 0; j < ETH_ALEN; j++) mac[j] = m[j];
+
+		// refresh or add (recycle the first slot when full)
+		if (i == tx->xdp.count && tx->xdp.count < XDP_NEIGHBOURS) tx->xdp.count++;
+		else if (i == tx->xdp.count) i = 0;
+		tx->xdp.neighbours[i].addr = addr;
+		memcpy(tx->xdp.neighbours[i].mac, mac, ETH_ALEN);
+		tx->xdp.neighbours[i].at = now;
+
+		fclose(in);
+		return true;
+	}
+
+	fclose(in);
+
+	return false;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static u16_t _xdp_checksum(u16_t *data, int len)
+{
+	u32_t sum = 0;
+
+	for (; len > 1; len -= 2) sum += *data++;
+	if (len) sum += *(u8_t*) data;
+	while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static int _xdp_build(raoptx_t *tx, u8_t *frame, u8_t *mac, struct sockaddr_in *addr, u8_t *data, int size)
+{
+	struct ether_header *eth = (struct ether_header*) frame;
+	struct iphdr *ip = (struct iphdr*) (eth + 1);
+	struct udphdr *udp = (struct udphdr*) (ip + 1);
+
+	memcpy(eth->ether_dhost, mac, ETH_ALEN);
+	memcpy(eth->ether_shost, tx->xdp.mac, ETH_ALEN);
+	eth->ether_type = htons(ETHERTYPE_IP);
+
+	memset(ip, 0, sizeof(struct iphdr));
+	ip->version = 4;
+	ip->ihl = sizeof(struct iphdr) / 4;
+	ip->tot_len = htons(sizeof(struct iphdr) + sizeof(struct udphdr) + size);
+	ip->id = htons(tx->xdp.id++);
+	ip->frag_off = htons(IP_DF);
+	ip->ttl = 64;
+	ip->protocol = IPPROTO_UDP;
+	ip->saddr = tx->local.s_addr;
+	ip->daddr = addr->sin_addr.s_addr;
+	ip->check = _xdp_checksum((u16_t*) ip, sizeof(struct iphdr));
+
+	// UDP checksum is optional over IPv4
+	udp->source = htons(tx->port);
+	udp->dest = addr->sin_port;
+	udp->len = htons(sizeof(struct udphdr) + size);
+	udp->check = 0;
+
+	memcpy(udp + 1, data, size);
+
+	return sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr) + size;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static int _xdp_flush(raoptx_t *tx)
+{
+	u32_t prod, cons, head = XDP_FRAMES - 1;
+	xdp_ring_t *cq = &tx->xdp.cq, *ring = &tx->xdp.tx;
+	struct xdp_desc *descs = ring->ring;
+	int sent = 0, queued = 0;
+
+	// get back frames the kernel is done with
+	cons = *cq->consumer;
+	prod = __atomic_load_n(cq->producer, __ATOMIC_ACQUIRE);
+	for (; cons != prod; cons++) tx->xdp.frames[tx->xdp.free++] = ((u64_t*) cq->ring)[cons & head];
+	__atomic_store_n(cq->consumer, cons, __ATOMIC_RELEASE);
+
+	prod = *ring->producer;
+	cons = __atomic_load_n(ring->consumer, __ATOMIC_ACQUIRE);
+
+	for (; sent < tx->count; sent++) {
+		struct sockaddr_in *addr = &tx->queue[sent].addr;
+		u8_t mac[ETH_ALEN];
+		u64_t frame;
+
+		// kernel path, which will also resolve the neighbour for next time
+		if (tx->queue[sent].size + (int) (sizeof(struct iphdr) + sizeof(struct udphdr)) > tx->xdp.mtu ||
+			!_xdp_neighbour(tx, addr->sin_addr, mac)) {
+			int n = sendto(tx->fd, (void*) tx->queue[sent].data, tx->queue[sent].size, 0,
+						   (struct sockaddr*) addr, sizeof(struct sockaddr_in));
+
+			tx->stats.syscalls++;
+			if (n == -1 && last_error() == ERROR_WOULDBLOCK) break;
+			if (n != tx->queue[sent].size) tx->stats.dropped++;
+			continue;
+		}
+
+		// no frame or ring full, rest waits for next tick
+		if (!tx->xdp.free || prod - cons == XDP_FRAMES) break;
+
+		frame = tx->xdp.frames[--tx->xdp.free];
+		descs[prod & head].addr = frame;
+		descs[prod & head].len = _xdp_build(tx, tx->xdp.umem + frame, mac, addr,
+											tx->queue[sent].data, tx->queue[sent].size);
+		descs[prod & head].options = 0;
+		prod++;
+		queued++;
+	}
+
+	if (queued) {
+		__atomic_store_n(ring->producer, prod, __ATOMIC_RELEASE);
+
+		// needed in copy mode and harmless otherwise
+		tx->stats.syscalls++;
+		if (sendto(tx->xdp.fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+			errno != EAGAIN && errno != ENOBUFS && errno != EBUSY) {
+			LOG_WARN("[%p]: AF_XDP failed (%s), back to sendmmsg", tx, strerror(errno));
+			_xdp_close(tx);
+			tx->backend = RAOPTX_SENDMMSG;
+		}
+	}
+
+	return _raoptx_sent(tx, sent);
+}
+#endif
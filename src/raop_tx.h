@@ -0,0 +1,62 @@
+/*****************************************************************************
+ * raop_tx.h: shared audio transmit engine
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+
+#ifndef __RAOP_TX_H_
+#define __RAOP_TX_H_
+
+#include "platform.h"
+
+/*
+ With many players, sending each audio packet with its own syscall is what
+ costs most. A transmit engine owns a single UDP socket on which all attached
+ players queue their packets (in order, each with its own destination) as they
+ are paced by raopcl_accept_frames. The application calls raoptx_flush once per
+ "tick" after having served all its players and everything goes out with a
+ single sendmmsg (when available). A full batch is flushed automatically.
+*/
+
+#define RAOPTX_MAX_BATCH	256
+
+/*
+ RAOPTX_URING (experimental, no gain measured over sendmmsg) submits the batch
+ through io_uring (Linux 5.3+) as independent sends, a single syscall whatever
+ the number of players. RAOPTX_XDP (experimental)
+ builds the frames itself and sends them via AF_XDP on the interface owning
+ the engine's local address, bypassing the UDP stack. Both fall back to
+ sendmmsg when the kernel refuses them. raoptx_bench (make bench) measures the
+ packets/s of each against one send() per packet, from raoptx_get_stats
+*/
+typedef enum { RAOPTX_SENDMMSG = 0, RAOPTX_URING, RAOPTX_XDP } raoptx_backend_t;
+
+struct raoptx_s;
+
+typedef struct {
+	u32_t queued, sent, dropped;
+	u32_t flushes, syscalls;
+} raoptx_stats_t;
+
+struct raoptx_s *raoptx_create(struct in_addr local, int batch);
+void 	raoptx_destroy(struct raoptx_s *tx);
+bool	raoptx_queue(struct raoptx_s *tx, struct sockaddr_in *addr, void *data, int size);
+int		raoptx_flush(struct raoptx_s *tx);
+raoptx_backend_t raoptx_set_backend(struct raoptx_s *tx, raoptx_backend_t backend);
+bool	raoptx_get_stats(struct raoptx_s *tx, raoptx_stats_t *stats);
+
+#endif
@@ -0,0 +1,166 @@
+/*****************************************************************************
+ * raoptx_bench.c: transmit engine throughput
+ *
+ * Copyright (C) 2016 Philippe <philippe_44@outlook.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "log_util.h"
+#include "aexcl_lib.h"
+#include "raop_tx.h"
+
+/*
+ Packets/s of each transmit path for a number of players, to compare one
+ send() per packet (what sessions do without an engine) with sendmmsg, io_uring
+ and AF_XDP. Each "tick" queues one audio-sized packet per player then flushes,
+ like an application serving all its players at once. Players are UDP sockets
+ bound on the local address so that nothing is refused; run it with a real
+ interface address to include the NIC (XDP needs one, and root). The counters
+ are the engine's own (raoptx_get_stats), a backend the kernel refuses falls
+ back to sendmmsg and is reported as such.
+
+	usage: raoptx_bench [<players> [<seconds> [<local ip>]]]
+*/
+
+#define BENCH_PACKET	(12 + 352 * 4)
+
+log_level	raop_loglevel = lWARN;
+log_level	util_loglevel = lWARN;
+
+static const char *names[] = { "sendmmsg", "io_uring", "af_xdp" };
+
+/*----------------------------------------------------------------------------*/
+u64_t get_ntp(struct ntp_s *ntp)
+{
+	struct timeval ctv;
+	struct ntp_s local;
+
+	gettimeofday(&ctv, NULL);
+	local.seconds  = ctv.tv_sec + 0x83AA7E80;
+	local.fraction = (((u64_t) ctv.tv_usec) << 32) / 1000000;
+
+	if (ntp) *ntp = local;
+
+	return (((u64_t) local.seconds) << 32) + local.fraction;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void report(char *what, u32_t sent, u32_t syscalls, u64_t start)
+{
+	double elapsed = (double) (get_ntp(NULL) - start) / ((u64_t) 1 << 32);
+
+	printf("%-10s %10.0f packets/s %8.2f packets/syscall\n", what,
+		   elapsed > 0 ? sent / elapsed : 0, syscalls ? (double) sent / syscalls : 0);
+}
+
+
+/*----------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+	int players = argc > 1 ? atoi(argv[1]) : 32;
+	int seconds = argc > 2 ? atoi(argv[2]) : 2;
+	struct in_addr local;
+	struct sockaddr_in *addr;
+	u8_t packet[BENCH_PACKET];
+	int *fds, i, backend;
+	u64_t start, end;
+
+	local.s_addr = inet_addr(argc > 3 ? argv[3] : "127.0.0.1");
+
+	if (players <= 0 || seconds <= 0 || local.s_addr == INADDR_NONE) {
+		printf("usage: %s [<players> [<seconds> [<local ip>]]]\n", argv[0]);
+		return 1;
+	}
+
+	fds = malloc(players * sizeof(int));
+	addr = calloc(players, sizeof(struct sockaddr_in));
+	memset(packet, 0x55, sizeof(packet));
+
+	for (i = 0; i < players; i++) {
+		unsigned short port = 0;
+
+		if ((fds[i] = open_udp_socket(local, &port, false)) == -1) {
+			printf("cannot open player socket %d\n", i);
+			return 1;
+		}
+
+		addr[i].sin_family = AF_INET;
+		addr[i].sin_addr = local;
+		addr[i].sin_port = htons(port);
+	}
+
+	printf("%d players, %d bytes packets, %ds per path\n", players, BENCH_PACKET, seconds);
+
+	// reference: one syscall per packet
+	{
+		int sd = socket(AF_INET, SOCK_DGRAM, 0);
+		u32_t sent = 0, calls = 0;
+
+		start = get_ntp(NULL);
+		end = start + ((u64_t) seconds << 32);
+
+		while (get_ntp(NULL) < end) {
+			for (i = 0; i < players; i++, calls++) {
+				if (sendto(sd, (void*) packet, sizeof(packet), 0, (struct sockaddr*) (addr + i), sizeof(addr[i])) > 0) sent++;
+			}
+		}
+
+		report("send", sent, calls, start);
+		closesocket(sd);
+	}
+
+	for (backend = RAOPTX_SENDMMSG; backend <= RAOPTX_XDP; backend++) {
+		struct raoptx_s *tx = raoptx_create(local, players);
+		raoptx_stats_t stats;
+		raoptx_backend_t used;
+
+		if (!tx) {
+			printf("cannot create transmit engine\n");
+			return 1;
+		}
+
+		if ((int) (used = raoptx_set_backend(tx, backend)) != backend) {
+			printf("%-10s not available (%s used)\n", names[backend], names[used]);
+			raoptx_destroy(tx);
+			continue;
+		}
+
+		start = get_ntp(NULL);
+		end = start + ((u64_t) seconds << 32);
+
+		while (get_ntp(NULL) < end) {
+			for (i = 0; i < players; i++) raoptx_queue(tx, addr + i, packet, sizeof(packet));
+			raoptx_flush(tx);
+		}
+
+		raoptx_get_stats(tx, &stats);
+		report((char*) names[backend], stats.sent, stats.syscalls, start);
+		if (stats.dropped) printf("%-10s %u dropped\n", "", stats.dropped);
+
+		raoptx_destroy(tx);
+	}
+
+	for (i = 0; i < players; i++) closesocket(fds[i]);
+	free(fds);
+	free(addr);
+
+	return 0;
+}
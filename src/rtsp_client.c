@@ -42,6 +42,7 @@ typedef struct rtspcl_s {
 	char *session;
 	const char *useragent;
 	struct in_addr local_addr;
+	int status;		// of last response, 0 when none
 } rtspcl_t;
 
 extern log_level 	raop_loglevel;
@@ -65,6 +66,13 @@ int rtspcl_get_serv_sock(struct rtspcl_s *p)
 }
 
 
+/*----------------------------------------------------------------------------*/
+int rtspcl_status(struct rtspcl_s *p)
+{
+	return p ? p->status : 0;
+}
+
+
 /*----------------------------------------------------------------------------*/
 struct rtspcl_s *rtspcl_create(char *useragent)
 {
@@ -626,6 +634,8 @@ static bool exec_request(struct rtspcl_s *rtspcld, char *cmd, char *content_type
 	   LOG_ERROR( "[%p]: couldn't write request (%d!=%d)", rtspcld, rval, len );
 	}
 
+	rtspcld->status = 0;
+
 	if (!get_response) return true;
 
 	if (read_line(rtspcld->fd, line, sizeof(line), timeout, 0) <= 0) {
@@ -638,6 +648,7 @@ static bool exec_request(struct rtspcl_s *rtspcld, char *cmd, char *content_type
 
 	token = strtok(line, delimiters);
 	token = strtok(NULL, delimiters);
+	if (token) rtspcld->status = atoi(token);
 	if (token == NULL || strcmp(token, "200")) {
 		if(get_response == 1) {
 			LOG_ERROR("[%p]: <------ : request failed, error %s", rtspcld, line);